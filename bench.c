@@ -0,0 +1,466 @@
+#include "imgfun.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Directory of the bundled images, set by CMake
+#ifndef IMGFUN_BENCH_IMAGES
+#define IMGFUN_BENCH_IMAGES "."
+#endif
+
+// Longest path the benchmark builds
+#define BENCH_MAX_PATH 4096
+
+// Runs of an operation: at least BENCH_MIN_RUNS and --min-time seconds, at most BENCH_MAX_RUNS
+#define BENCH_MIN_RUNS 5
+#define BENCH_MAX_RUNS 1000
+
+// Bundled images measured before the synthetic ones
+static const char *bench_bundled[] = {
+    "lena_gray.bmp", "barbara_gray.bmp", "lena_color.bmp", "flowers_color.bmp"
+};
+
+// Sides of the synthetic square images
+static const int bench_sizes[] = { 256, 1024, 4096, 16384 };
+
+// Image an operation runs on, with the files it reads and writes
+typedef struct {
+    t_bmp img;
+    const char *input;   // File the image was loaded from
+    const char *output;  // Scratch file the save operation writes
+    uint8_t *pristine;   // Pixel buffer as loaded, put back before every run
+    size_t size;         // Bytes of the pixel buffer
+} t_benchImage;
+
+// Operation measured, the color depths it exists for (0 for both) and how to run it once
+typedef struct {
+    const char *name;
+    int depths;
+    int (*run)(t_benchImage *image);
+} t_benchOp;
+
+// Timing of one operation on one image
+typedef struct {
+    char image[64];
+    int colorDepth;
+    int width;
+    int height;
+    const char *op;
+    int runs;
+    double median;  // Seconds
+    double p99;     // Seconds
+    double mpix;    // Megapixels per second at the median time
+} t_benchResult;
+
+// Settings given on the command line
+typedef struct {
+    int maxSize;          // Largest synthetic side measured
+    double minTime;       // Seconds each operation runs for at least
+    int runs;             // Fixed number of runs, 0 to use minTime
+    const char *json;     // File the results are written to as JSON, NULL for none
+    const char *images;   // Directory of the bundled images
+    const char *only;     // Only measure the operations whose name contains this, NULL for all
+} t_benchSettings;
+
+// Results gathered so far
+typedef struct {
+    t_benchResult *items;
+    int count;
+    int capacity;
+} t_benchResults;
+
+// Current monotonic time in seconds
+static double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Load the image's input into a scratch image and free it
+static int bench_load(t_benchImage *image) {
+    t_bmp img;
+    int status = bmp_load(image->input, &img);
+    if (status == 0) bmp_free(&img);
+    return status;
+}
+
+static int bench_save(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_saveImage(image->output, image->img.img8);
+    return bmp24_saveImage(image->img.img24, image->output);
+}
+
+static int bench_negative(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_negative(image->img.img8);
+    return bmp24_negative(image->img.img24);
+}
+
+static int bench_brightness(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_brightness(image->img.img8, 1);
+    return bmp24_brightness(image->img.img24, 1);
+}
+
+static int bench_threshold(t_benchImage *image) {
+    return bmp8_threshold(image->img.img8, 128);
+}
+
+static int bench_grayscale(t_benchImage *image) {
+    return bmp24_grayscale(image->img.img24);
+}
+
+static int bench_boxBlur(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_boxBlur(image->img.img8);
+    return bmp24_boxBlur(image->img.img24);
+}
+
+static int bench_gaussian(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_gaussianBlur(image->img.img8);
+    return bmp24_gaussianBlur(image->img.img24);
+}
+
+static int bench_outline(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_outline(image->img.img8);
+    return bmp24_outline(image->img.img24);
+}
+
+static int bench_emboss(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_emboss(image->img.img8);
+    return bmp24_emboss(image->img.img24);
+}
+
+static int bench_sharpen(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_sharpen(image->img.img8);
+    return bmp24_sharpen(image->img.img24);
+}
+
+// Box blur of radius 7 (15x15), the running sum path
+static int bench_boxBlur15(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_boxBlurRadius(image->img.img8, 7, CONV_EDGE_ZERO);
+    return bmp24_boxBlurRadius(image->img.img24, 7, CONV_EDGE_ZERO);
+}
+
+// Gaussian blur of sigma 2.5, the exact separable kernel (box blurs only from sigma 3)
+static int bench_gaussianSigma(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_gaussianBlurSigma(image->img.img8, 2.5f, CONV_EDGE_ZERO);
+    return bmp24_gaussianBlurSigma(image->img.img24, 2.5f, CONV_EDGE_ZERO);
+}
+
+// 7-tap binomial blur given as two 1D kernels, the separable float path
+static int bench_separable7(t_benchImage *image) {
+    static const float taps[7] = { 1 / 64.0f, 6 / 64.0f, 15 / 64.0f, 20 / 64.0f, 15 / 64.0f, 6 / 64.0f,
+                                   1 / 64.0f };
+    if (image->img.colorDepth == 8) {
+        return bmp8_applySeparableFilter(image->img.img8, taps, taps, 7, CONV_EDGE_ZERO);
+    }
+    return bmp24_applySeparableFilter(image->img.img24, taps, taps, 7, CONV_EDGE_ZERO);
+}
+
+// 5x5 kernel that isn't separable (nor integer), the general 2D float path
+static int bench_kernel5(t_benchImage *image) {
+    static float weights[5][5] = {
+        { 0.00f, 0.02f, 0.03f, 0.02f, 0.00f },
+        { 0.02f, 0.05f, 0.07f, 0.05f, 0.02f },
+        { 0.03f, 0.07f, 0.17f, 0.07f, 0.03f },
+        { 0.02f, 0.05f, 0.07f, 0.05f, 0.02f },
+        { 0.00f, 0.02f, 0.03f, 0.02f, 0.00f },
+    };
+    float *kernel[5] = { weights[0], weights[1], weights[2], weights[3], weights[4] };
+    if (image->img.colorDepth == 8) return bmp8_applyFilter(image->img.img8, kernel, 5);
+    return bmp24_applyFilter(image->img.img24, kernel, 5);
+}
+
+static int bench_histogram(t_benchImage *image) {
+    if (image->img.colorDepth == 24) {
+        t_histogram hist;
+        bmp24_computeHistograms(image->img.img24, &hist);
+        return 0;
+    }
+    unsigned int *hist = bmp8_computeHistogram(image->img.img8);
+    if (!hist) return imgfun_lastError();
+    free(hist);
+    return 0;
+}
+
+// Histogram, cumulative histogram and remapping, as the menus and the command line run it
+static int bench_equalize(t_benchImage *image) {
+    if (image->img.colorDepth == 24) return bmp24_equalize(image->img.img24);
+    unsigned int *hist = bmp8_computeHistogram(image->img.img8);
+    unsigned int *cdf = hist ? bmp8_computeCDF(hist) : NULL;
+    int status = cdf ? bmp8_equalize(image->img.img8, cdf) : imgfun_lastError();
+    free(hist);
+    free(cdf);
+    return status;
+}
+
+static int bench_clahe(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return bmp8_clahe(image->img.img8, 64, 2.0f);
+    return bmp24_clahe(image->img.img24, 64, 2.0f);
+}
+
+static const t_benchOp bench_operations[] = {
+    { "load", 0, bench_load },
+    { "save", 0, bench_save },
+    { "negative", 0, bench_negative },
+    { "brightness", 0, bench_brightness },
+    { "threshold", 8, bench_threshold },
+    { "grayscale", 24, bench_grayscale },
+    { "box-blur", 0, bench_boxBlur },
+    { "gaussian", 0, bench_gaussian },
+    { "outline", 0, bench_outline },
+    { "emboss", 0, bench_emboss },
+    { "sharpen", 0, bench_sharpen },
+    { "box-blur-15", 0, bench_boxBlur15 },
+    { "gaussian-2.5", 0, bench_gaussianSigma },
+    { "separable-7", 0, bench_separable7 },
+    { "kernel-5x5", 0, bench_kernel5 },
+    { "histogram", 0, bench_histogram },
+    { "equalize", 0, bench_equalize },
+    { "clahe", 0, bench_clahe },
+};
+
+// Write a square synthetic image: gradients with some noise, so the histogram is spread
+static int bench_writeSynthetic(const char *filename, int size, int colorDepth) {
+    t_bmp img = { colorDepth, NULL, NULL };
+    if (colorDepth == 8) img.img8 = bmp8_allocate(size, size);
+    else img.img24 = bmp24_allocate(size, size, colorDepth);
+    if (!img.img8 && !img.img24) return IMGFUN_ERROR_MEMORY;
+
+    int channels = colorDepth / 8;
+    size_t rowSize = (size + 3) & ~3u;
+    unsigned int seed = 2463534242u;
+    for (int y = 0; y < size; y++) {
+        // The 8-bit rows are stored bottom-up, the 24-bit ones top-down
+        uint8_t *row = colorDepth == 8 ? img.img8->data + (size_t)y * rowSize
+                                       : (uint8_t *)bmp24_row(img.img24, size - 1 - y);
+        for (int x = 0; x < size * channels; x++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            row[x] = (unsigned char)((x * 255 / (size * channels) + y * 255 / size) / 2 + (seed & 31));
+        }
+    }
+
+    int status = colorDepth == 8 ? bmp8_saveImage(filename, img.img8)
+                                 : bmp24_saveImage(img.img24, filename);
+    bmp_free(&img);
+    return status;
+}
+
+// Pixel buffer the image currently uses (filters swap it with their back buffer)
+static uint8_t *bench_pixels(t_benchImage *image) {
+    if (image->img.colorDepth == 8) return image->img.img8->data;
+    return (uint8_t *)image->img.img24->pixels;
+}
+
+// Put the pixels back as they were loaded, so every run of every operation sees the
+// same input whatever ran before it (brightness saturates, blurs pile up otherwise)
+static void bench_restore(t_benchImage *image) {
+    memcpy(bench_pixels(image), image->pristine, image->size);
+}
+
+static int bench_compareTimes(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Run an operation as many times as the settings ask and fill its result
+static int bench_measure(const t_benchOp *op, t_benchImage *image, const t_benchSettings *settings,
+                         double *times, t_benchResult *result) {
+    bench_restore(image);
+    int status = op->run(image); // Warm-up: first touch of the pages and of the back buffer
+    double start = bench_now();
+    int runs = 0;
+    while (status == 0 && runs < BENCH_MAX_RUNS) {
+        if (settings->runs ? runs >= settings->runs
+                           : runs >= BENCH_MIN_RUNS && bench_now() - start >= settings->minTime) break;
+        bench_restore(image);
+        double begin = bench_now();
+        status = op->run(image);
+        times[runs++] = bench_now() - begin;
+    }
+    if (status != 0) return status;
+
+    qsort(times, runs, sizeof(double), bench_compareTimes);
+    result->op = op->name;
+    result->runs = runs;
+    result->median = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+    int rank = (99 * runs + 99) / 100; // Nearest rank of the 99th percentile
+    result->p99 = times[rank - 1];
+    result->mpix = result->median > 0 ? result->width * (double)result->height / 1e6 / result->median : 0;
+    return 0;
+}
+
+// Measure every operation of the image's color depth on one file
+static int bench_file(const char *name, const char *input, const char *output,
+                      const t_benchSettings *settings, t_benchResults *results, double *times) {
+    t_benchImage image = { .input = input, .output = output };
+    int status = bmp_load(input, &image.img);
+    if (status != 0) {
+        fprintf(stderr, "imgfun_bench: couldn't load %s (%s)\n", input, imgfun_errorString(status));
+        return status;
+    }
+
+    t_benchResult base = { .colorDepth = image.img.colorDepth };
+    snprintf(base.image, sizeof(base.image), "%s", name);
+    if (base.colorDepth == 8) {
+        base.width = (int)image.img.img8->width;
+        base.height = (int)image.img.img8->height;
+    } else {
+        base.width = image.img.img24->width;
+        base.height = image.img.img24->height;
+    }
+    printf("%s: %dx%d, %d-bit\n", name, base.width, base.height, base.colorDepth);
+
+    if (base.colorDepth == 8) image.size = image.img.img8->dataSize;
+    else image.size = (size_t)image.img.img24->stride * base.height * sizeof(t_pixel);
+    image.pristine = malloc(image.size);
+    if (!image.pristine) {
+        fprintf(stderr, "imgfun_bench: out of memory for a copy of %s\n", name);
+        bmp_free(&image.img);
+        return IMGFUN_ERROR_MEMORY;
+    }
+    memcpy(image.pristine, bench_pixels(&image), image.size);
+
+    int count = sizeof(bench_operations) / sizeof(bench_operations[0]);
+    for (int i = 0; i < count && status == 0; i++) {
+        const t_benchOp *op = &bench_operations[i];
+        if (op->depths != 0 && op->depths != base.colorDepth) continue;
+        if (settings->only && !strstr(op->name, settings->only)) continue;
+
+        if (results->count == results->capacity) {
+            int capacity = results->capacity ? 2 * results->capacity : 64;
+            t_benchResult *items = realloc(results->items, capacity * sizeof(t_benchResult));
+            if (!items) {
+                status = IMGFUN_ERROR_MEMORY;
+                break;
+            }
+            results->items = items;
+            results->capacity = capacity;
+        }
+        t_benchResult *result = &results->items[results->count];
+        *result = base;
+        status = bench_measure(op, &image, settings, times, result);
+        if (status != 0) {
+            fprintf(stderr, "imgfun_bench: %s failed on %s (%s)\n", op->name, name,
+                    imgfun_errorString(status));
+            break;
+        }
+        results->count++;
+        printf("  %-13s median %10.3f ms   p99 %10.3f ms   %9.1f MPix/s   %4d runs\n", op->name,
+               result->median * 1e3, result->p99 * 1e3, result->mpix, result->runs);
+        fflush(stdout);
+    }
+
+    free(image.pristine);
+    bmp_free(&image.img);
+    remove(output);
+    return status;
+}
+
+// Write the results as JSON
+static int bench_writeJson(const char *filename, const t_benchResults *results) {
+    FILE *f = fopen(filename, "w");
+    if (!f) return IMGFUN_ERROR_OPEN;
+    fprintf(f, "{\n  \"threads\": %d,\n  \"results\": [", pool_threadCount());
+    for (int i = 0; i < results->count; i++) {
+        const t_benchResult *r = &results->items[i];
+        fprintf(f, "%s\n    {\"image\": \"", i ? "," : "");
+        for (const char *c = r->image; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', f);
+            fputc(*c, f);
+        }
+        fprintf(f, "\", \"depth\": %d, \"width\": %d, \"height\": %d, \"op\": \"%s\", \"runs\": %d, "
+                   "\"median_ms\": %.6f, \"p99_ms\": %.6f, \"mpix_per_s\": %.3f}",
+                r->colorDepth, r->width, r->height, r->op, r->runs, r->median * 1e3, r->p99 * 1e3,
+                r->mpix);
+    }
+    fprintf(f, "\n  ]\n}\n");
+    return fclose(f) == 0 ? 0 : IMGFUN_ERROR_WRITE;
+}
+
+static void bench_printUsage(FILE *out) {
+    fprintf(out,
+            "Usage: imgfun_bench [OPTIONS]\n"
+            "Times every operation on the bundled images, then on synthetic 8-bit and 24-bit\n"
+            "squares from 256 to 16384 pixels wide, and prints the median time, the 99th\n"
+            "percentile and the throughput at the median.\n"
+            "Options:\n"
+            "  --json=FILE       also write the results to FILE as JSON\n"
+            "  --max-size=N      largest synthetic side (default 16384, 0 for none)\n"
+            "  --min-time=SEC    time each operation runs for at least (default 0.5)\n"
+            "  --runs=N          run each operation exactly N times instead\n"
+            "  --only=TEXT       only the operations whose name contains TEXT\n"
+            "  --threads=N       worker threads of the filters (default: one per CPU)\n"
+            "  --images=DIR      directory of the bundled images\n");
+}
+
+int main(int argc, char **argv) {
+    t_benchSettings settings = { 16384, 0.5, 0, NULL, IMGFUN_BENCH_IMAGES, NULL };
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = strchr(arg, '=');
+        value = value ? value + 1 : "";
+        int ok = 1;
+        if (!strncmp(arg, "--json=", 7)) settings.json = value;
+        else if (!strncmp(arg, "--max-size=", 11)) settings.maxSize = atoi(value);
+        else if (!strncmp(arg, "--min-time=", 11)) settings.minTime = atof(value);
+        else if (!strncmp(arg, "--runs=", 7)) ok = (settings.runs = atoi(value)) > 0;
+        else if (!strncmp(arg, "--only=", 7)) settings.only = value;
+        else if (!strncmp(arg, "--threads=", 10)) pool_setThreadCount(atoi(value));
+        else if (!strncmp(arg, "--images=", 9)) settings.images = value;
+        else if (!strcmp(arg, "--help")) {
+            bench_printUsage(stdout);
+            return 0;
+        } else ok = 0;
+        if (!ok) {
+            bench_printUsage(stderr);
+            return 2;
+        }
+    }
+    if (settings.runs > BENCH_MAX_RUNS) settings.runs = BENCH_MAX_RUNS;
+
+    const char *tmp = getenv("TMPDIR");
+    if (!tmp || !*tmp) tmp = "/tmp";
+    char synthetic[BENCH_MAX_PATH], output[BENCH_MAX_PATH], path[BENCH_MAX_PATH];
+    snprintf(synthetic, sizeof(synthetic), "%s/imgfun_bench_%d_in.bmp", tmp, (int)getpid());
+    snprintf(output, sizeof(output), "%s/imgfun_bench_%d_out.bmp", tmp, (int)getpid());
+
+    double *times = malloc(BENCH_MAX_RUNS * sizeof(double));
+    t_benchResults results = {0};
+    int failed = 0;
+    if (!times) return 1;
+    printf("imgfun_bench: %d threads\n", pool_threadCount());
+
+    int bundled = sizeof(bench_bundled) / sizeof(bench_bundled[0]);
+    for (int i = 0; i < bundled; i++) {
+        snprintf(path, sizeof(path), "%s/%s", settings.images, bench_bundled[i]);
+        if (bench_file(bench_bundled[i], path, output, &settings, &results, times) != 0) failed = 1;
+    }
+
+    int sizes = sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+    for (int i = 0; i < sizes && bench_sizes[i] <= settings.maxSize; i++) {
+        for (int depth = 8; depth <= 24; depth += 16) {
+            char name[64];
+            snprintf(name, sizeof(name), "synthetic-%d-%d", bench_sizes[i], depth);
+            if (bench_writeSynthetic(synthetic, bench_sizes[i], depth) != 0) {
+                fprintf(stderr, "imgfun_bench: couldn't write %s\n", synthetic);
+                failed = 1;
+            } else if (bench_file(name, synthetic, output, &settings, &results, times) != 0) {
+                failed = 1;
+            }
+            remove(synthetic);
+        }
+    }
+
+    if (settings.json && bench_writeJson(settings.json, &results) != 0) {
+        fprintf(stderr, "imgfun_bench: couldn't write %s\n", settings.json);
+        failed = 1;
+    }
+    free(results.items);
+    free(times);
+    bmp_releaseScratch();
+    pool_shutdown();
+    return failed;
+}
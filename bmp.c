@@ -0,0 +1,148 @@
+#include "bmp.h"
+#include "imgfun.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read a little-endian 16-bit value from a header buffer
+uint16_t bmp_readU16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Read a little-endian 32-bit value from a header buffer
+uint32_t bmp_readU32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Write a little-endian 16-bit value into a header buffer
+void bmp_writeU16(unsigned char *p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+// Write a little-endian 32-bit value into a header buffer
+void bmp_writeU32(unsigned char *p, uint32_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+// Map a whole file privately (copy-on-write) into memory
+void *bmp_mapFile(const char *filename, size_t *size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        imgfun_fail(IMGFUN_ERROR_OPEN, "Unable to open file %s", filename);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 54) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+        close(fd);
+        return NULL;
+    }
+
+    // Pages are shared with the page cache until written, then copied
+    void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        imgfun_fail(IMGFUN_ERROR_OPEN, "Unable to map file %s", filename);
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    trace_count(TRACE_BYTES_READ, *size);
+    return mapping;
+}
+
+// Alignment of scratch buffers, as for t_bmp24 pixel buffers
+#define BMP_SCRATCH_ALIGNMENT 64
+
+// Buffer kept by each thread between filters
+static _Thread_local void *bmp_scratch = NULL;
+static _Thread_local size_t bmp_scratchSize = 0;
+
+// Size actually allocated for a scratch buffer of size bytes
+static size_t bmp_scratchBytes(size_t size) {
+    size = (size + BMP_SCRATCH_ALIGNMENT - 1) / BMP_SCRATCH_ALIGNMENT * BMP_SCRATCH_ALIGNMENT;
+    return size == 0 ? BMP_SCRATCH_ALIGNMENT : size;
+}
+
+// Get an aligned buffer for filter output, reusing the thread's buffer when it fits exactly
+void *bmp_takeScratch(size_t size) {
+    size = bmp_scratchBytes(size);
+    if (bmp_scratch && bmp_scratchSize == size) {
+        void *buffer = bmp_scratch;
+        bmp_scratch = NULL;
+        return buffer;
+    }
+    trace_count(TRACE_ALLOCATIONS, 1);
+    return aligned_alloc(BMP_SCRATCH_ALIGNMENT, size);
+}
+
+// Give a buffer back to the thread for the next filter
+void bmp_giveScratch(void *buffer, size_t size) {
+    if (!buffer) return;
+    free(bmp_scratch);
+    bmp_scratch = buffer;
+    bmp_scratchSize = bmp_scratchBytes(size);
+}
+
+// Free the buffer kept by the calling thread
+void bmp_releaseScratch(void) {
+    free(bmp_scratch);
+    bmp_scratch = NULL;
+    bmp_scratchSize = 0;
+}
+
+// Map a BMP file, detect its color depth and decode it
+static int bmp_loadMapped(const char *filename, t_bmp *out) {
+    out->colorDepth = 0;
+    out->img8 = NULL;
+    out->img24 = NULL;
+
+    size_t size;
+    unsigned char *file = bmp_mapFile(filename, &size);
+    if (!file) return imgfun_lastError();
+
+    uint16_t bits = bmp_readU16(&file[28]);
+    if (bits == 8) {
+        // The image keeps the mapping: pixels are used in place
+        out->img8 = bmp8_fromMapping(file, size);
+        if (!out->img8) return imgfun_lastError();
+    } else if (bits == 24) {
+        out->img24 = bmp24_decodeImage(file, size);
+        munmap(file, size);
+        if (!out->img24) return imgfun_lastError();
+    } else {
+        munmap(file, size);
+        return imgfun_fail(IMGFUN_ERROR_FORMAT, "Only 8-bit and 24-bit images are supported.");
+    }
+
+    out->colorDepth = bits;
+    return 0;
+}
+
+// Open a BMP file once, detect its color depth and load it
+int bmp_load(const char *filename, t_bmp *out) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int status = bmp_loadMapped(filename, out);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Free whichever image a t_bmp holds
+void bmp_free(t_bmp *img) {
+    bmp8_free(img->img8);
+    bmp24_free(img->img24);
+    img->img8 = NULL;
+    img->img24 = NULL;
+    img->colorDepth = 0;
+}
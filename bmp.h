@@ -0,0 +1,49 @@
+#ifndef BMP_H
+#define BMP_H
+#include <stddef.h>
+#include <stdint.h>
+#include "bmp8.h"
+#include "bmp24.h"
+
+// Structure holding an image of either supported color depth
+typedef struct {
+    int colorDepth;  // 8 or 24, 0 when nothing is loaded
+    t_bmp8 *img8;    // Set when colorDepth is 8
+    t_bmp24 *img24;  // Set when colorDepth is 24
+} t_bmp;
+
+// Function to read a little-endian 16-bit value from a header buffer
+uint16_t bmp_readU16(const unsigned char *p);
+
+// Function to read a little-endian 32-bit value from a header buffer
+uint32_t bmp_readU32(const unsigned char *p);
+
+// Function to write a little-endian 16-bit value into a header buffer
+void bmp_writeU16(unsigned char *p, uint16_t v);
+
+// Function to write a little-endian 32-bit value into a header buffer
+void bmp_writeU32(unsigned char *p, uint32_t v);
+
+// Function to map a whole file privately (copy-on-write) into memory
+void *bmp_mapFile(const char *filename, size_t *size);
+
+// Function to open a BMP file once, detect its color depth and load it.
+// 8-bit pixels stay in the copy-on-write file mapping. Returns 0, or an IMGFUN_ERROR_ code.
+int bmp_load(const char *filename, t_bmp *out);
+
+// Function to get a 64-byte aligned buffer of at least size bytes for filter output.
+// Reuses the buffer the calling thread last gave back when it has the same size, so
+// chains of filters and batches of same-size images don't allocate per call.
+void *bmp_takeScratch(size_t size);
+
+// Function to give a buffer from bmp_takeScratch (or one allocated the same way) back.
+// Each thread keeps the last buffer given back; the one it replaces is freed.
+void bmp_giveScratch(void *buffer, size_t size);
+
+// Function to free the buffer kept by the calling thread (call before a thread exits)
+void bmp_releaseScratch(void);
+
+// Function to free whichever image a t_bmp holds
+void bmp_free(t_bmp *img);
+
+#endif // BMP_H
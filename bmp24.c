@@ -1,289 +1,615 @@
 #include "bmp24.h"
+#include "bmp.h"
+#include "imgfun.h"
+#include "trace.h"
+#include "convolution.h"
+#include "pointwise.h"
+#include "histogram.h"
+#include "threadpool.h"
+#include "cpu.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
-// Allocate a 2D pixel matrix
+// Minimum number of pixels handed to one thread by the per-pixel operations
+#define BMP24_PARALLEL_GRAIN 16384
+
+// Parameters of a per-pixel operation run in parallel over bands of rows
+typedef struct {
+    t_bmp24 *img;
+    const uint8_t *map;     // Luma lookup table of an equalization
+    uint8_t *luma;          // Luma plane replacing map in an adaptive equalization
+    int (*chroma)[3];       // Fixed-point chroma matrix of an equalization
+} t_bmp24Job;
+
+// Rows per band of a parallel loop over the rows of img
+static int bmp24_grain(const t_bmp24 *img) {
+    return img->width >= BMP24_PARALLEL_GRAIN ? 1 : BMP24_PARALLEL_GRAIN / img->width;
+}
+
+// Number of pixels between two rows: every row starts on a 16-byte boundary
+static int bmp24_computeStride(int width) {
+    return (width + 15) & ~15;
+}
+
+// Allocate an aligned buffer of height rows of stride pixels
+static t_pixel *bmp24_allocatePixels(int stride, int height) {
+    size_t size = (size_t)stride * height * sizeof(t_pixel);
+    size = (size + BMP24_ALIGNMENT - 1) / BMP24_ALIGNMENT * BMP24_ALIGNMENT;
+    if (size == 0) size = BMP24_ALIGNMENT;
+    trace_count(TRACE_ALLOCATIONS, 1);
+    return aligned_alloc(BMP24_ALIGNMENT, size);
+}
+
+// Point every entry of the row view at its row in the pixel buffer
+static void bmp24_bindRows(t_bmp24 *img) {
+    for (int y = 0; y < img->height; y++) {
+        img->data[y] = bmp24_row(img, y);
+    }
+}
+
+// Allocate an image backed by one contiguous pixel buffer
+t_bmp24 *bmp24_allocate(int width, int height, int colorDepth) {
+    if (width <= 0 || height <= 0) return NULL;
+
+    t_bmp24 *img = malloc(sizeof(t_bmp24));
+    if (!img) return NULL;
+
+    img->width = width;
+    img->height = height;
+    img->colorDepth = colorDepth;
+    img->stride = bmp24_computeStride(width);
+    img->back = NULL;
+    img->inPlace = 0;
+    img->pixels = bmp24_allocatePixels(img->stride, height);
+    img->data = malloc(height * sizeof(t_pixel *));
+    if (!img->pixels || !img->data) {
+        free(img->pixels);
+        free(img->data);
+        free(img);
+        return NULL;
+    }
+
+    bmp24_bindRows(img);
+    return img;
+}
+
+// Allocate a 2D pixel matrix whose rows share a single contiguous block
 t_pixel **bmp24_allocateDataPixels(int width, int height) {
     t_pixel **pixels = malloc(height * sizeof(t_pixel *));
     if (!pixels) return NULL;
+
+    int stride = bmp24_computeStride(width);
+    t_pixel *block = bmp24_allocatePixels(stride, height);
+    if (!block) {
+        free(pixels);
+        return NULL;
+    }
     for (int i = 0; i < height; i++) {
-        pixels[i] = malloc(width * sizeof(t_pixel));
-        if (!pixels[i]) {
-            for (int j = 0; j < i; j++) free(pixels[j]);
-            free(pixels);
-            return NULL;
-        }
+        pixels[i] = block + (size_t)i * stride;
     }
     return pixels;
 }
 
 // Free memory allocated for pixel data
 void bmp24_freeDataPixels(t_pixel **pixels, int height) {
-    for (int i = 0; i < height; i++) free(pixels[i]);
+    if (!pixels) return;
+    if (height > 0) free(pixels[0]);
     free(pixels);
 }
 
+// Size in bytes of the pixel buffer of img
+static size_t bmp24_bufferSize(const t_bmp24 *img) {
+    return (size_t)img->stride * img->height * sizeof(t_pixel);
+}
+
 // Free the entire BMP image structure
 void bmp24_free(t_bmp24 *img) {
     if (img) {
-        bmp24_freeDataPixels(img->data, img->height);
+        bmp_giveScratch(img->back, bmp24_bufferSize(img));
+        free(img->data);
+        free(img->pixels);
         free(img);
     }
 }
 
-// Load a BMP24 image from a file
-t_bmp24 *bmp24_loadImage(const char *filename) {
+// Size in bytes of the file and info headers written by bmp24_saveImage
+#define BMP24_HEADER_SIZE 54
+
+// Number of bytes of one row in the file, including the padding to 4 bytes
+static size_t bmp24_fileRowSize(int width) {
+    return ((size_t)width * 3 + 3) & ~(size_t)3;
+}
+
+// Swap the first and third byte of every pixel (BGR <-> RGB) in a row
+static void bmp24_swapRedBlue(unsigned char *dst, const unsigned char *src, int width) {
+    for (int x = 0; x < width; x++) {
+        unsigned char b = src[3 * x];
+        unsigned char g = src[3 * x + 1];
+        unsigned char r = src[3 * x + 2];
+        dst[3 * x] = r;
+        dst[3 * x + 1] = g;
+        dst[3 * x + 2] = b;
+    }
+}
+
+// Read a BMP24 image from a file
+static t_bmp24 *bmp24_readFile(const char *filename) {
     FILE *f = fopen(filename, "rb");
     if (!f) {
-        printf("File doesn't exist: %s\n", filename);
+        imgfun_fail(IMGFUN_ERROR_OPEN, "File doesn't exist: %s", filename);
         return NULL;
     }
 
-    uint16_t type;
-    int32_t width, height;
-    uint16_t bits;
-    uint32_t compression, offset;
-
-    fseek(f, 0, SEEK_SET);
-    fread(&type, sizeof(uint16_t), 1, f);
-
-    fseek(f, 18, SEEK_SET);
-    fread(&width, sizeof(int32_t), 1, f);
-    fread(&height, sizeof(int32_t), 1, f);
-
-    fseek(f, 28, SEEK_SET);
-    fread(&bits, sizeof(uint16_t), 1, f);
-
-    fseek(f, 30, SEEK_SET);
-    fread(&compression, sizeof(uint32_t), 1, f);
+    unsigned char header[BMP24_HEADER_SIZE];
+    if (fread(header, 1, BMP24_HEADER_SIZE, f) != BMP24_HEADER_SIZE) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+        fclose(f);
+        return NULL;
+    }
 
-    fseek(f, 10, SEEK_SET);
-    fread(&offset, sizeof(uint32_t), 1, f);
+    uint16_t type = bmp_readU16(&header[0]);
+    uint32_t offset = bmp_readU32(&header[10]);
+    int32_t width = (int32_t)bmp_readU32(&header[18]);
+    int32_t height = (int32_t)bmp_readU32(&header[22]);
+    uint16_t bits = bmp_readU16(&header[28]);
+    uint32_t compression = bmp_readU32(&header[30]);
 
     if (type != 0x4D42 || bits != 24 || compression != 0) {
-        printf("Please uncompress your file.\n");
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Please uncompress your file.");
+        fclose(f);
+        return NULL;
+    }
+    if (width <= 0 || height <= 0) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
         fclose(f);
         return NULL;
     }
 
-    t_bmp24 *img = malloc(sizeof(t_bmp24));
-    img->width = width;
-    img->height = height;
-    img->colorDepth = bits;
-    img->data = bmp24_allocateDataPixels(width, height);
-    if (!img->data) {
+    t_bmp24 *img = bmp24_allocate(width, height, bits);
+    if (!img) {
+        imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
         fclose(f);
-        free(img);
         return NULL;
     }
 
+    // A padded file row always fits in a row of the buffer (the stride is
+    // rounded up to 16 pixels), so rows are read straight into place,
+    // bottom-up, and swizzled in memory afterwards. The last row may omit its
+    // padding, as some writers do.
+    size_t rowSize = bmp24_fileRowSize(width);
     fseek(f, offset, SEEK_SET);
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            unsigned char bgr[3];
-            fread(bgr, 1, 3, f);
-            img->data[height - 1 - y][x].blue = bgr[0];
-            img->data[height - 1 - y][x].green = bgr[1];
-            img->data[height - 1 - y][x].red = bgr[2];
+    for (int y = height - 1; y >= 0; y--) {
+        unsigned char *row = (unsigned char *)bmp24_row(img, y);
+        size_t size = y > 0 ? rowSize : (size_t)width * 3;
+        if (fread(row, 1, size, f) != size) {
+            imgfun_fail(IMGFUN_ERROR_READ, "Pixel read failed.");
+            bmp24_free(img);
+            fclose(f);
+            return NULL;
         }
-        fseek(f, padding, SEEK_CUR);
+        bmp24_swapRedBlue(row, row, width);
     }
 
     fclose(f);
-    printf("Image loaded! %dx%d\n", width, height);
+    trace_count(TRACE_BYTES_READ, BMP24_HEADER_SIZE + rowSize * height);
     return img;
 }
 
-// Save a BMP24 image to a file
-void bmp24_saveImage(t_bmp24 *img, const char *filename) {
-    FILE *f = fopen(filename, "wb");
-    if (!f) {
-        printf("Error (no spaces please): %s\n", filename);
-        return;
+// Load a BMP24 image from a file
+t_bmp24 *bmp24_loadImage(const char *filename) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_bmp24 *img = bmp24_readFile(filename);
+    trace_end(&span, __func__, img ? (unsigned long long)img->width * img->height : 0);
+    return img;
+}
+
+// Check the headers of a BMP24 file held in memory and convert its pixels
+static t_bmp24 *bmp24_decode(const unsigned char *file, size_t size) {
+    if (size < BMP24_HEADER_SIZE) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+        return NULL;
+    }
+
+    uint16_t type = bmp_readU16(&file[0]);
+    uint32_t offset = bmp_readU32(&file[10]);
+    int32_t width = (int32_t)bmp_readU32(&file[18]);
+    int32_t height = (int32_t)bmp_readU32(&file[22]);
+    uint16_t bits = bmp_readU16(&file[28]);
+    uint32_t compression = bmp_readU32(&file[30]);
+
+    if (type != 0x4D42 || bits != 24 || compression != 0) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Please uncompress your file.");
+        return NULL;
+    }
+
+    if (width <= 0 || height <= 0) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+        return NULL;
+    }
+
+    // The last row may omit its padding, as some writers do
+    size_t rowSize = bmp24_fileRowSize(width);
+    if (offset > size
+        || size - offset < rowSize * (height - 1) + (size_t)width * 3) {
+        imgfun_fail(IMGFUN_ERROR_READ, "Pixel read failed.");
+        return NULL;
+    }
+
+    t_bmp24 *img = bmp24_allocate(width, height, bits);
+    if (!img) {
+        imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
+        return NULL;
     }
 
-    uint16_t type = 0x4D42;
-    uint32_t offset = 54;
-    uint32_t size = offset + (img->width * 3 + (4 - (img->width * 3 % 4)) % 4) * img->height;
-    uint16_t reserved = 0;
-
-    fwrite(&type, sizeof(uint16_t), 1, f);
-    fwrite(&size, sizeof(uint32_t), 1, f);
-    fwrite(&reserved, sizeof(uint16_t), 1, f);
-    fwrite(&reserved, sizeof(uint16_t), 1, f);
-    fwrite(&offset, sizeof(uint32_t), 1, f);
-
-    uint32_t headerSize = 40;
-    uint16_t planes = 1;
-    uint16_t bits = 24;
-    uint32_t compression = 0;
-    uint32_t imageSize = size - offset;
-    int32_t resolution = 2835;
-
-    fwrite(&headerSize, sizeof(uint32_t), 1, f);
-    fwrite(&img->width, sizeof(int32_t), 1, f);
-    fwrite(&img->height, sizeof(int32_t), 1, f);
-    fwrite(&planes, sizeof(uint16_t), 1, f);
-    fwrite(&bits, sizeof(uint16_t), 1, f);
-    fwrite(&compression, sizeof(uint32_t), 1, f);
-    fwrite(&imageSize, sizeof(uint32_t), 1, f);
-    fwrite(&resolution, sizeof(int32_t), 1, f);
-    fwrite(&resolution, sizeof(int32_t), 1, f);
-
-    fwrite(&compression, sizeof(uint32_t), 1, f);
-    fwrite(&compression, sizeof(uint32_t), 1, f);
-
-    int padding = (4 - (img->width * 3) % 4) % 4;
-    unsigned char pad[3] = {0, 0, 0};
+    const unsigned char *in = file + offset;
+    for (int y = height - 1; y >= 0; y--) {
+        bmp24_swapRedBlue((unsigned char *)bmp24_row(img, y), in, width);
+        in += rowSize;
+    }
+    return img;
+}
 
+// Decode a BMP24 image from a complete file held in memory
+t_bmp24 *bmp24_decodeImage(const unsigned char *file, size_t size) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_bmp24 *img = bmp24_decode(file, size);
+    trace_end(&span, __func__, img ? (unsigned long long)img->width * img->height : 0);
+    return img;
+}
+
+// Write a BMP24 image to a file
+static int bmp24_writeFile(t_bmp24 *img, const char *filename) {
+    size_t rowSize = bmp24_fileRowSize(img->width);
+    size_t imageSize = rowSize * img->height;
+    unsigned char *file = calloc(BMP24_HEADER_SIZE + imageSize, 1);
+    if (!file) {
+        return imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
+    }
+
+    unsigned char *header = file;
+    bmp_writeU16(&header[0], 0x4D42);                                    // Type
+    bmp_writeU32(&header[2], (uint32_t)(BMP24_HEADER_SIZE + imageSize)); // File size
+    bmp_writeU32(&header[10], BMP24_HEADER_SIZE);                        // Pixel offset
+    bmp_writeU32(&header[14], 40);                                       // Info header size
+    bmp_writeU32(&header[18], (uint32_t)img->width);
+    bmp_writeU32(&header[22], (uint32_t)img->height);
+    bmp_writeU16(&header[26], 1);                                        // Planes
+    bmp_writeU16(&header[28], 24);                                       // Bits per pixel
+    bmp_writeU32(&header[34], (uint32_t)imageSize);
+    bmp_writeU32(&header[38], 2835);                                     // Horizontal resolution
+    bmp_writeU32(&header[42], 2835);                                     // Vertical resolution
+
+    // Rows are stored bottom-up; padding bytes stay zero from calloc
+    unsigned char *out = file + BMP24_HEADER_SIZE;
     for (int y = img->height - 1; y >= 0; y--) {
-        for (int x = 0; x < img->width; x++) {
-            unsigned char bgr[3] = {
-                img->data[y][x].blue,
-                img->data[y][x].green,
-                img->data[y][x].red
-            };
-            fwrite(bgr, 1, 3, f);
-        }
-        fwrite(pad, 1, padding, f);
+        bmp24_swapRedBlue(out, (const unsigned char *)bmp24_row(img, y), img->width);
+        out += rowSize;
     }
 
-    fclose(f);
-    printf("Image saved in %s\n", filename);
+    FILE *f = fopen(filename, "wb");
+    if (!f) {
+        free(file);
+        return imgfun_fail(IMGFUN_ERROR_WRITE, "Error (no spaces please): %s", filename);
+    }
+    int ok = fwrite(file, 1, BMP24_HEADER_SIZE + imageSize, f) == BMP24_HEADER_SIZE + imageSize;
+    if (fclose(f) != 0) ok = 0;
+    free(file);
+    if (!ok) {
+        return imgfun_fail(IMGFUN_ERROR_WRITE, "Save error: %s", filename);
+    }
+    trace_count(TRACE_BYTES_WRITTEN, BMP24_HEADER_SIZE + imageSize);
+    return 0;
+}
+
+// Save a BMP24 image to a file
+int bmp24_saveImage(t_bmp24 *img, const char *filename) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int status = bmp24_writeFile(img, filename);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// View the pixels stored in a buffer laid out like img as a raster
+static t_raster bmp24_raster(const t_bmp24 *img, t_pixel *pixels) {
+    t_raster raster = {
+        (uint8_t *)pixels, img->width, img->height, 3, (size_t)img->stride * sizeof(t_pixel)
+    };
+    return raster;
+}
+
+// Run every pixel through a lookup table in one pass
+void bmp24_applyLUT(t_bmp24 *img, const t_lut *lut) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster raster = bmp24_raster(img, img->pixels);
+    lut_apply(lut, &raster);
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
 }
 
 // Apply a negative effect to the image
-void bmp24_negative(t_bmp24 *img) {
-    for (int y = 0; y < img->height; y++) {
-        for (int x = 0; x < img->width; x++) {
-            t_pixel *p = &img->data[y][x];
-            p->red = 255 - p->red;
-            p->green = 255 - p->green;
-            p->blue = 255 - p->blue;
-        }
-    }
+int bmp24_negative(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_lut lut;
+    lut_identity(&lut);
+    lut_negative(&lut);
+    bmp24_applyLUT(img, &lut);
+    trace_end(&span, __func__, 0);
+    return 0;
 }
 
-// Convert the image to grayscale
-void bmp24_grayscale(t_bmp24 *img) {
-    for (int y = 0; y < img->height; y++) {
-        for (int x = 0; x < img->width; x++) {
-            t_pixel *p = &img->data[y][x];
-            uint8_t g = (p->red + p->green + p->blue) / 3;
-            p->red = p->green = p->blue = g;
-        }
+// Converts a row of width pixels to grayscale
+typedef void (*t_bmp24GrayRow)(t_pixel *row, int width);
+
+// Grayscale of a row of pixels, always inlined into one copy per instruction set
+// (the loop vectorizes with each of them)
+static inline __attribute__((always_inline)) void bmp24_grayRow(t_pixel *row, int width) {
+    for (int x = 0; x < width; x++) {
+        t_pixel *p = &row[x];
+        uint8_t g = (p->red + p->green + p->blue) / 3;
+        p->red = p->green = p->blue = g;
     }
 }
 
-// Adjust the brightness of the image
-void bmp24_brightness(t_bmp24 *img, int value) {
-    for (int y = 0; y < img->height; y++) {
-        for (int x = 0; x < img->width; x++) {
-            t_pixel *p = &img->data[y][x];
-            p->red = fminf(fmaxf(p->red + value, 0), 255);
-            p->green = fminf(fmaxf(p->green + value, 0), 255);
-            p->blue = fminf(fmaxf(p->blue + value, 0), 255);
-        }
+static void bmp24_grayScalar(t_pixel *row, int width) {
+    bmp24_grayRow(row, width);
+}
+
+#if CPU_X86
+static CPU_TARGET_SSE42 void bmp24_graySse42(t_pixel *row, int width) {
+    bmp24_grayRow(row, width);
+}
+
+static CPU_TARGET_AVX2 void bmp24_grayAvx2(t_pixel *row, int width) {
+    bmp24_grayRow(row, width);
+}
+
+static CPU_TARGET_AVX512 void bmp24_grayAvx512(t_pixel *row, int width) {
+    bmp24_grayRow(row, width);
+}
+#endif
+
+// Grayscale row function of the instruction set cpu_level() picks
+static t_bmp24GrayRow bmp24_selectGray(void) {
+#if CPU_X86
+    switch (cpu_level()) {
+        case CPU_AVX512:
+            return bmp24_grayAvx512;
+        case CPU_AVX2:
+            return bmp24_grayAvx2;
+        case CPU_SSE42:
+            return bmp24_graySse42;
+        default:
+            break;
     }
+#endif
+    return bmp24_grayScalar;
 }
 
-// Apply convolution to a pixel
-t_pixel bmp24_convolution(t_bmp24 *img, int x, int y, float **kernel, int kernelSize) {
-    int n = kernelSize / 2;
-    float r = 0, g = 0, b = 0;
+// Grayscale of rows [y0, y1)
+static void bmp24_grayscaleTask(void *context, int y0, int y1) {
+    t_bmp24Job *job = context;
+    t_bmp24 *img = job->img;
+    t_bmp24GrayRow grayRow = bmp24_selectGray();
+    for (int y = y0; y < y1; y++) grayRow(bmp24_row(img, y), img->width);
+}
 
-    for (int ky = -n; ky <= n; ky++) {
-        for (int kx = -n; kx <= n; kx++) {
-            int px = x + kx;
-            int py = y + ky;
-            if (px >= 0 && px < img->width && py >= 0 && py < img->height) {
-                t_pixel p = img->data[py][px];
-                float coeff = kernel[ky + n][kx + n];
-                r += p.red * coeff;
-                g += p.green * coeff;
-                b += p.blue * coeff;
-            }
+// Convert the image to grayscale
+int bmp24_grayscale(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_bmp24Job job = { .img = img };
+    pool_parallelFor(img->height, bmp24_grain(img), bmp24_grayscaleTask, &job);
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return 0;
+}
+
+// Adjust the brightness of the image
+int bmp24_brightness(t_bmp24 *img, int value) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_lut lut;
+    lut_identity(&lut);
+    lut_brightness(&lut, value);
+    bmp24_applyLUT(img, &lut);
+    trace_end(&span, __func__, 0);
+    return 0;
+}
+
+// Get the back buffer of the image (allocated by its first filter only) and
+// describe both buffers as rasters. Returns 0 or an IMGFUN_ERROR_ code.
+static int bmp24_beginFilter(t_bmp24 *img, t_raster *src, t_raster *dst) {
+    if (!img->back) {
+        img->back = bmp_takeScratch(bmp24_bufferSize(img));
+        if (!img->back) {
+            return imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
         }
     }
+    *src = bmp24_raster(img, img->pixels);
+    *dst = bmp24_raster(img, img->back);
+    return 0;
+}
 
-    t_pixel result;
-    result.red = (uint8_t)fminf(fmaxf(r, 0), 255);
-    result.green = (uint8_t)fminf(fmaxf(g, 0), 255);
-    result.blue = (uint8_t)fminf(fmaxf(b, 0), 255);
-    return result;
+// Swap the back buffer in when the filter succeeded (status 0): the replaced pixels
+// become the output buffer of the next filter. Returns 0 or an IMGFUN_ERROR_ code.
+static int bmp24_endFilter(t_bmp24 *img, int status) {
+    if (status != 0) {
+        return imgfun_fail(IMGFUN_ERROR_MEMORY, "Filter failed.");
+    }
+    t_pixel *newPixels = img->back;
+    img->back = img->pixels;
+    img->pixels = newPixels;
+    bmp24_bindRows(img);
+    return 0;
 }
 
 // Apply a filter to the image using a convolution kernel
-void bmp24_applyFilter(t_bmp24 *img, float **kernel, int kernelSize) {
-    t_pixel **newData = bmp24_allocateDataPixels(img->width, img->height);
-    if (!newData) return;
+int bmp24_applyFilter(t_bmp24 *img, float **kernel, int kernelSize) {
+    return bmp24_applyFilterEdge(img, kernel, kernelSize, CONV_EDGE_ZERO);
+}
 
-    for (int y = 0; y < img->height; y++) {
-        for (int x = 0; x < img->width; x++) {
-            newData[y][x] = bmp24_convolution(img, x, y, kernel, kernelSize);
+// Turn in-place filtering on or off
+void bmp24_setInPlace(t_bmp24 *img, int enabled) {
+    img->inPlace = enabled;
+}
+
+// Apply a filter to the image using a convolution kernel and the given edge mode
+int bmp24_applyFilterEdge(t_bmp24 *img, float **kernel, int kernelSize, t_convEdge edge) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int status;
+    if (img->inPlace) {
+        t_raster raster = bmp24_raster(img, img->pixels);
+        status = conv_applyInPlace(&raster, kernel, kernelSize, CONV_TRUNCATE, edge);
+        if (status != 0) status = imgfun_fail(IMGFUN_ERROR_MEMORY, "Filter failed.");
+    } else {
+        t_raster src, dst;
+        status = bmp24_beginFilter(img, &src, &dst);
+        if (status == 0) {
+            status = bmp24_endFilter(img, conv_apply(&src, &dst, kernel, kernelSize,
+                                                     CONV_TRUNCATE, edge));
         }
     }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
+}
+
+// Apply a separable filter given as a horizontal and a vertical 1D kernel
+int bmp24_applySeparableFilter(t_bmp24 *img, const float *row, const float *column, int kernelSize,
+                               t_convEdge edge) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp24_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp24_endFilter(img, conv_applySeparable(&src, &dst, row, column, kernelSize,
+                                                          CONV_TRUNCATE, edge));
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
+}
 
-    bmp24_freeDataPixels(img->data, img->height);
-    img->data = newData;
+// Apply an integer filter (weights / divisor)
+int bmp24_applyIntFilter(t_bmp24 *img, const int *weights, int kernelSize, int divisor,
+                         t_convEdge edge) {
+    t_intKernel kernel;
+    if (kernelSize < 1 || kernelSize > CONV_MAX_INT_KERNEL || divisor < 1) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported integer kernel.");
+    }
+    kernel.size = kernelSize;
+    kernel.divisor = divisor;
+    memcpy(kernel.weights, weights, kernelSize * kernelSize * sizeof(int));
+
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp24_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp24_endFilter(img, conv_applyInt(&src, &dst, &kernel, CONV_TRUNCATE, edge));
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
 
 // Apply a box blur filter
-void bmp24_boxBlur(t_bmp24 *img) {
-    float box[3][3] = {
-        {1/9.f, 1/9.f, 1/9.f},
-        {1/9.f, 1/9.f, 1/9.f},
-        {1/9.f, 1/9.f, 1/9.f}
-    };
-    float* kernel[3] = { box[0], box[1], box[2] };
-    bmp24_applyFilter(img, kernel, 3);
+int bmp24_boxBlur(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_BOX, kernel);
+    int status = bmp24_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Apply a box blur of any radius
+int bmp24_boxBlurRadius(t_bmp24 *img, int radius, t_convEdge edge) {
+    if (radius < 0 || radius > CONV_MAX_BOX_RADIUS) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported blur radius.");
+    }
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp24_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp24_endFilter(img, conv_boxBlur(&src, &dst, radius, CONV_TRUNCATE, edge));
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
 
 // Apply a Gaussian blur filter
-void bmp24_gaussianBlur(t_bmp24 *img) {
-    float gauss[3][3] = {
-        {1/16.f, 2/16.f, 1/16.f},
-        {2/16.f, 4/16.f, 2/16.f},
-        {1/16.f, 2/16.f, 1/16.f}
-    };
-    float* kernel[3] = { gauss[0], gauss[1], gauss[2] };
-    bmp24_applyFilter(img, kernel, 3);
+int bmp24_gaussianBlur(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_GAUSSIAN, kernel);
+    int status = bmp24_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Apply a Gaussian blur of any standard deviation
+int bmp24_gaussianBlurSigma(t_bmp24 *img, float sigma, t_convEdge edge) {
+    if (!(sigma > 0.0f) || sigma > CONV_MAX_SIGMA) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported blur sigma.");
+    }
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp24_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp24_endFilter(img, conv_gaussianBlur(&src, &dst, sigma, CONV_TRUNCATE, edge));
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
 
 // Apply an outline filter
-void bmp24_outline(t_bmp24 *img) {
-    float outline[3][3] = {
-        {-1, -1, -1},
-        {-1,  8, -1},
-        {-1, -1, -1}
-    };
-    float* kernel[3] = { outline[0], outline[1], outline[2] };
-    bmp24_applyFilter(img, kernel, 3);
+int bmp24_outline(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_OUTLINE, kernel);
+    int status = bmp24_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
 }
 
 // Apply an emboss filter
-void bmp24_emboss(t_bmp24 *img) {
-    float emboss[3][3] = {
-        {-2, -1, 0},
-        {-1,  1, 1},
-        { 0,  1, 2}
-    };
-    float* kernel[3] = { emboss[0], emboss[1], emboss[2] };
-    bmp24_applyFilter(img, kernel, 3);
+int bmp24_emboss(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_EMBOSS, kernel);
+    int status = bmp24_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
 }
 
 // Apply a sharpen filter
-void bmp24_sharpen(t_bmp24 *img) {
-    float sharpen[3][3] = {
-        { 0, -1,  0},
-        {-1,  5, -1},
-        { 0, -1,  0}
-    };
-    float* kernel[3] = { sharpen[0], sharpen[1], sharpen[2] };
-    bmp24_applyFilter(img, kernel, 3);
+int bmp24_sharpen(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_SHARPEN, kernel);
+    int status = bmp24_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Count the red, green and blue values and the luma of the image in a single pass
+void bmp24_computeHistograms(const t_bmp24 *img, t_histogram *hist) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster raster = bmp24_raster(img, img->pixels);
+    hist_compute(&raster, hist);
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
 }
 
 // Compute the histogram for the red channel
@@ -291,8 +617,9 @@ unsigned int *bmp24_computeHistogramR(const t_bmp24 *img) {
     unsigned int *hist = calloc(256, sizeof(unsigned int));
     if (!hist) return 0;
     for (int y = 0; y < img->height; y++) {
+        const t_pixel *row = bmp24_row(img, y);
         for (int x = 0; x < img->width; x++) {
-            uint8_t r = img->data[y][x].red;
+            uint8_t r = row[x].red;
             hist[r]++;
         }
     }
@@ -304,8 +631,9 @@ unsigned int *bmp24_computeHistogramG(const t_bmp24 *img) {
     unsigned int *hist = calloc(256, sizeof(unsigned int));
     if (!hist) return 0;
     for (int y = 0; y < img->height; y++) {
+        const t_pixel *row = bmp24_row(img, y);
         for (int x = 0; x < img->width; x++) {
-            uint8_t g = img->data[y][x].green;
+            uint8_t g = row[x].green;
             hist[g]++;
         }
     }
@@ -317,8 +645,9 @@ unsigned int *bmp24_computeHistogramB(const t_bmp24 *img) {
     unsigned int *hist = calloc(256, sizeof(unsigned int));
     if (!hist) return 0;
     for (int y = 0; y < img->height; y++) {
+        const t_pixel *row = bmp24_row(img, y);
         for (int x = 0; x < img->width; x++) {
-            uint8_t b = img->data[y][x].blue;
+            uint8_t b = row[x].blue;
             hist[b]++;
         }
     }
@@ -349,72 +678,127 @@ void computeEqualizationLUT(unsigned int *hist, int total, uint8_t *lut) {
     }
 }
 
-// Apply histogram equalization to the image
-void bmp24_equalize(t_bmp24 *img) {
-    int width = img->width;
-    int height = img->height;
-    int size = width * height;
-
-    float *Y = malloc(size * sizeof(float));
-    float *U = malloc(size * sizeof(float));
-    float *V = malloc(size * sizeof(float));
-
-    if (!Y || !U || !V) {
-        printf("Memory alloc failed.\n");
-        free(Y); free(U); free(V);
-        return;
-    }
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            t_pixel p = img->data[y][x];
-            int i = y * width + x;
+// Fractional bits of the fixed-point color transforms
+#define BMP24_YUV_SHIFT 20
 
-            float r = p.red;
-            float g = p.green;
-            float b = p.blue;
+// Rebuild rows [y0, y1) with their luma replaced by the equalized one. The chroma
+// is recomputed from the pixel itself, so no plane of U, V values is kept around:
+// out = map[Y] (or the luma plane) + (YUV to RGB) * (0, U, V), with (0, U, V) taken from RGB
+static void bmp24_equalizeTask(void *context, int y0, int y1) {
+    t_bmp24Job *job = context;
+    t_bmp24 *img = job->img;
+    int (*m)[3] = job->chroma;
+    const int max = (255 << BMP24_YUV_SHIFT) + (1 << BMP24_YUV_SHIFT) - 1;
 
-            Y[i] = 0.299f * r + 0.587f * g + 0.114f * b;
-            U[i] = -0.14713f * r - 0.28886f * g + 0.436f * b;
-            V[i] =  0.615f * r - 0.51499f * g - 0.10001f * b;
+    for (int y = y0; y < y1; y++) {
+        t_pixel *row = bmp24_row(img, y);
+        for (int x = 0; x < img->width; x++) {
+            int r = row[x].red, g = row[x].green, b = row[x].blue;
+            int equalized = job->luma ? job->luma[(size_t)y * img->width + x]
+                                      : job->map[hist_luma(r, g, b)];
+            int luma = equalized << BMP24_YUV_SHIFT;
+            int out[3];
+            for (int c = 0; c < 3; c++) {
+                // Truncated like the float conversion, after clamping to [0, 255]
+                int v = luma + m[c][0] * r + m[c][1] * g + m[c][2] * b;
+                out[c] = v < 0 ? 0 : (v > max ? 255 : v >> BMP24_YUV_SHIFT);
+            }
+            row[x].red = (uint8_t)out[0];
+            row[x].green = (uint8_t)out[1];
+            row[x].blue = (uint8_t)out[2];
         }
     }
+}
 
-    unsigned int hist[256] = {0};
-    for (int i = 0; i < size; i++) {
-        int y_val = (int)fminf(fmaxf(roundf(Y[i]), 0), 255);
-        hist[y_val]++;
+// Chroma part of the YUV round trip, RGB -> (0, U, V) -> RGB, in fixed point
+static void bmp24_chromaMatrix(int m[3][3]) {
+    static const double toU[3] = { -0.14713, -0.28886, 0.436 };
+    static const double toV[3] = { 0.615, -0.51499, -0.10001 };
+    static const double fromUV[3][2] = { { 0.0, 1.13983 }, { -0.39465, -0.58060 }, { 2.03211, 0.0 } };
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            double w = fromUV[c][0] * toU[k] + fromUV[c][1] * toV[k];
+            m[c][k] = (int)lround(w * (1 << BMP24_YUV_SHIFT));
+        }
     }
+}
 
-    unsigned int cdf[256] = {0};
-    cdf[0] = hist[0];
-    for (int i = 1; i < 256; i++) {
-        cdf[i] = cdf[i - 1] + hist[i];
+// Build the luma map of an equalization from the luma histogram of total pixels
+void bmp24_equalizationMap(const unsigned int *luma, unsigned int total, uint8_t *map) {
+    unsigned int cdf[256];
+    hist_cumulate(luma, cdf);
+    // Every pixel is black (or there is none): nothing to spread
+    if (total <= cdf[0]) {
+        for (int i = 0; i < 256; i++) map[i] = (uint8_t)i;
+        return;
     }
-
-    uint8_t map[256];
     for (int i = 0; i < 256; i++) {
-        map[i] = (uint8_t)roundf(((float)(cdf[i] - cdf[0]) / (size - cdf[0])) * 255.0f);
+        map[i] = (uint8_t)roundf(((float)(cdf[i] - cdf[0]) / (total - cdf[0])) * 255.0f);
     }
+}
 
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int i = y * width + x;
-
-            float y_eq = (float)map[(int)fminf(fmaxf(roundf(Y[i]), 0), 255)];
-            float u = U[i];
-            float v = V[i];
+// Replace the luma of every pixel by map[luma], keeping its chroma
+void bmp24_remapLuma(t_bmp24 *img, const uint8_t *map) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int chroma[3][3];
+    bmp24_chromaMatrix(chroma);
+    t_bmp24Job job = { .img = img, .map = map, .chroma = chroma };
+    pool_parallelFor(img->height, bmp24_grain(img), bmp24_equalizeTask, &job);
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+}
 
-            float r = y_eq + 1.13983f * v;
-            float g = y_eq - 0.39465f * u - 0.58060f * v;
-            float b = y_eq + 2.03211f * u;
+// Apply histogram equalization to the luma of the image, in two passes and integer
+// arithmetic: count the luma, then remap every pixel in place
+int bmp24_equalize(t_bmp24 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_histogram hist;
+    bmp24_computeHistograms(img, &hist);
+    uint8_t map[256];
+    bmp24_equalizationMap(hist.luma, (unsigned int)img->width * img->height, map);
+    bmp24_remapLuma(img, map);
+    trace_end(&span, __func__, 0);
+    return 0;
+}
 
-            img->data[y][x].red   = (uint8_t)fminf(fmaxf(r, 0), 255);
-            img->data[y][x].green = (uint8_t)fminf(fmaxf(g, 0), 255);
-            img->data[y][x].blue  = (uint8_t)fminf(fmaxf(b, 0), 255);
-        }
+// Fill rows [y0, y1) of the luma plane of an adaptive equalization
+static void bmp24_lumaTask(void *context, int y0, int y1) {
+    t_bmp24Job *job = context;
+    t_bmp24 *img = job->img;
+    for (int y = y0; y < y1; y++) {
+        const t_pixel *row = bmp24_row(img, y);
+        uint8_t *out = job->luma + (size_t)y * img->width;
+        hist_lumaRow((const uint8_t *)row, img->width, out);
     }
+}
 
-    free(Y); free(U); free(V);
-    printf("Histogram Equalization applied.\n");
+// Apply contrast-limited adaptive histogram equalization to the luma of the image
+int bmp24_clahe(t_bmp24 *img, int tileSize, float clipLimit) {
+    if (tileSize < HIST_MIN_TILE) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported tile size.");
+    }
+    uint8_t *luma = malloc((size_t)img->width * img->height);
+    if (!luma) {
+        return imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory alloc failed.");
+    }
+    t_traceSpan span;
+    trace_begin(&span);
+    trace_count(TRACE_ALLOCATIONS, 1);
+
+    int chroma[3][3];
+    bmp24_chromaMatrix(chroma);
+    t_bmp24Job job = { .img = img, .luma = luma, .chroma = chroma };
+    pool_parallelFor(img->height, bmp24_grain(img), bmp24_lumaTask, &job);
+
+    t_raster plane = { luma, img->width, img->height, 1, (size_t)img->width };
+    int status = 0;
+    if (hist_clahe(&plane, tileSize, clipLimit) != 0) {
+        status = imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory alloc failed.");
+    } else {
+        pool_parallelFor(img->height, bmp24_grain(img), bmp24_equalizeTask, &job);
+    }
+    free(luma);
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
@@ -1,6 +1,10 @@
 #ifndef BMP24_H
 #define BMP24_H
+#include <stddef.h>
 #include <stdint.h>
+#include "convolution.h"
+#include "pointwise.h"
+#include "histogram.h"
 
 // Structure representing a pixel in BMP 24-bit images
 typedef struct {
@@ -9,55 +13,111 @@ typedef struct {
     uint8_t blue;  // Blue component
 } t_pixel;
 
+// Alignment in bytes of the pixel buffer owned by a t_bmp24
+#define BMP24_ALIGNMENT 64
+
 // Structure representing a BMP 24-bit image
 typedef struct {
     int width;       // Width of the image
     int height;      // Height of the image
     int colorDepth;  // Color depth of the image
-    t_pixel **data;  // 2D array of pixels
+    t_pixel **data;  // Row pointers into pixels (compatibility view, data[y][x])
+    t_pixel *pixels; // Single aligned buffer holding every row
+    int stride;      // Distance between the start of two rows, in pixels
+    t_pixel *back;   // Output buffer of the filters, swapped with pixels after each one
+    int inPlace;     // Non-zero when kernel filters write back into pixels
 } t_bmp24;
 
+// Function to get a pointer to the first pixel of row y
+static inline t_pixel *bmp24_row(const t_bmp24 *img, int y) {
+    return img->pixels + (size_t)y * img->stride;
+}
+
+// Function to allocate an image backed by one contiguous pixel buffer
+t_bmp24 *bmp24_allocate(int width, int height, int colorDepth);
+
 // Function to allocate memory for a 2D pixel array
 t_pixel **bmp24_allocateDataPixels(int width, int height);
 
 // Function to free memory allocated for a 2D pixel array
 void bmp24_freeDataPixels(t_pixel **pixels, int height);
 
-// Function to free the entire BMP image structure
+// Function to free the entire BMP image structure. The filter output buffer is
+// handed to bmp_giveScratch, so the next image of the same size reuses it.
 void bmp24_free(t_bmp24 *img);
 
 // Function to load a BMP image from a file
 t_bmp24 *bmp24_loadImage(const char *filename);
 
-// Function to save a BMP image to a file
-void bmp24_saveImage(t_bmp24 *img, const char *filename);
+// Function to decode a BMP image from a complete file held in memory
+t_bmp24 *bmp24_decodeImage(const unsigned char *file, size_t size);
+
+// Function to save a BMP image to a file. Returns 0, or an IMGFUN_ERROR_ code.
+int bmp24_saveImage(t_bmp24 *img, const char *filename);
+
+// Function to turn in-place filtering on or off. In-place, applyFilter and the 3x3 filters
+// write their result back into pixels, holding only a few rows aside instead of a second
+// image, with the same output. The other filters still use the back buffer.
+void bmp24_setInPlace(t_bmp24 *img, int enabled);
+
+// Function to run every pixel through a lookup table (one table per color) in one pass.
+// Build the table with the lut_ functions to chain several adjustments for the cost of one.
+void bmp24_applyLUT(t_bmp24 *img, const t_lut *lut);
+
+// The effects, filters, equalization and CLAHE below return 0, or an IMGFUN_ERROR_ code
 
 // Function to apply a negative effect to the image
-void bmp24_negative(t_bmp24 *img);
+int bmp24_negative(t_bmp24 *img);
 
 // Function to convert the image to grayscale
-void bmp24_grayscale(t_bmp24 *img);
+int bmp24_grayscale(t_bmp24 *img);
 
 // Function to adjust the brightness of the image
-void bmp24_brightness(t_bmp24 *img, int value);
+int bmp24_brightness(t_bmp24 *img, int value);
+
+// Function to apply a convolution filter to the image (pixels outside count as 0)
+int bmp24_applyFilter(t_bmp24 *img, float **kernel, int kernelSize);
 
-// Function to apply a convolution filter to the image
-void bmp24_applyFilter(t_bmp24 *img, float **kernel, int kernelSize);
+// Function to apply a convolution filter with the given handling of taps outside the image.
+// CONV_EDGE_CLAMP or CONV_EDGE_MIRROR avoid the dark frame zero padding leaves on blurs.
+int bmp24_applyFilterEdge(t_bmp24 *img, float **kernel, int kernelSize, t_convEdge edge);
+
+// Function to apply a separable filter given as a horizontal and a vertical 1D kernel.
+// Costs 2k taps per pixel instead of k*k; applyFilter uses it for rank-1 kernels.
+int bmp24_applySeparableFilter(t_bmp24 *img, const float *row, const float *column, int kernelSize,
+                               t_convEdge edge);
+
+// Function to apply an integer filter: each pixel becomes sum(weight * pixel) / divisor.
+// weights holds kernelSize * kernelSize values, row by row; fixed-point kernels with
+// n fractional bits use divisor = 1 << n. Runs entirely in integer arithmetic.
+int bmp24_applyIntFilter(t_bmp24 *img, const int *weights, int kernelSize, int divisor,
+                         t_convEdge edge);
 
 // Function to apply a box blur filter
-void bmp24_boxBlur(t_bmp24 *img);
+int bmp24_boxBlur(t_bmp24 *img);
+
+// Function to apply a box blur of any radius ((2 * radius + 1)^2 pixels).
+// Uses running sums, so a large radius costs the same per pixel as radius 1.
+int bmp24_boxBlurRadius(t_bmp24 *img, int radius, t_convEdge edge);
 
 // Function to apply a Gaussian blur filter
-void bmp24_gaussianBlur(t_bmp24 *img);
+int bmp24_gaussianBlur(t_bmp24 *img);
+
+// Function to apply a Gaussian blur of any standard deviation.
+// Runs in constant time per pixel; see conv_gaussianBlur for the accuracy.
+int bmp24_gaussianBlurSigma(t_bmp24 *img, float sigma, t_convEdge edge);
 
 // Function to apply an outline filter
-void bmp24_outline(t_bmp24 *img);
+int bmp24_outline(t_bmp24 *img);
 
 // Function to apply an emboss filter
-void bmp24_emboss(t_bmp24 *img);
+int bmp24_emboss(t_bmp24 *img);
 
 // Function to apply a sharpen filter
-void bmp24_sharpen(t_bmp24 *img);
+int bmp24_sharpen(t_bmp24 *img);
+
+// Function to count the red, green and blue values and the luma of the image in a single pass
+void bmp24_computeHistograms(const t_bmp24 *img, t_histogram *hist);
 
 // Function to compute the histogram for the red channel
 unsigned int *bmp24_computeHistogramR(const t_bmp24 *img);
@@ -72,6 +132,17 @@ unsigned int *bmp24_computeHistogramB(const t_bmp24 *img);
 void computeEqualizationLUT(unsigned int *hist, int totalPixels, uint8_t *lut);
 
 // Function to apply histogram equalization to the image
-void bmp24_equalize(t_bmp24 *img);
+int bmp24_equalize(t_bmp24 *img);
+
+// Function to build the luma map bmp24_equalize uses from the luma histogram of total pixels
+void bmp24_equalizationMap(const unsigned int *luma, unsigned int total, uint8_t *map);
+
+// Function to replace the luma of every pixel by map[luma], keeping its chroma.
+// With bmp24_equalizationMap, equalizes images counted piece by piece.
+void bmp24_remapLuma(t_bmp24 *img, const uint8_t *map);
+
+// Function to apply contrast-limited adaptive histogram equalization to the luma of the image.
+// Same parameters as bmp8_clahe; colors keep their chroma like bmp24_equalize.
+int bmp24_clahe(t_bmp24 *img, int tileSize, float clipLimit);
 
 #endif // BMP24_H
@@ -1,20 +1,68 @@
 #include "bmp8.h"
+#include "bmp.h"
+#include "imgfun.h"
+#include "trace.h"
+#include "convolution.h"
+#include "pointwise.h"
+#include "histogram.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
 #include <math.h>
+#include <sys/mman.h>
+
+// Distance between the start of two pixel rows (rows are padded to 4 bytes)
+static unsigned int bmp8_rowSize(const t_bmp8 *img) {
+    return (img->width + 3) / 4 * 4;
+}
+
+// View the pixel rows of an 8-bit image stored in data as a raster
+static t_raster bmp8_raster(const t_bmp8 *img, unsigned char *data) {
+    t_raster raster = { data, (int)img->width, (int)img->height, 1, bmp8_rowSize(img) };
+    return raster;
+}
+
+// Check the dimensions read from the header and make dataSize cover every pixel row,
+// which the filters walk whatever the header says (0 or too small). Returns 0 or an
+// IMGFUN_ERROR_ code.
+static int bmp8_checkSize(t_bmp8 *img) {
+    if ((int32_t)img->width <= 0 || (int32_t)img->height <= 0) {
+        return imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+    }
+    size_t rows = (size_t)bmp8_rowSize(img) * img->height;
+    if (rows > UINT_MAX) {
+        return imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+    }
+    if (img->dataSize < rows) img->dataSize = (unsigned int)rows;
+    return 0;
+}
 
 // Compute the histogram of an 8-bit BMP image
 unsigned int *bmp8_computeHistogram(t_bmp8 *img) {
     unsigned int *hist = calloc(256, sizeof(unsigned int));
     if (!hist) {
-        printf("Memory allocation failed.\n");
+        imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
         return NULL;
     }
-
-    for (unsigned int i = 0; i < img->dataSize; i++) {
-        hist[img->data[i]]++;
+    t_traceSpan span;
+    trace_begin(&span);
+
+    // Row padding is not counted: equalization spreads width * height pixels
+    t_histogram counts;
+    t_raster raster = bmp8_raster(img, img->data);
+    hist_compute(&raster, &counts);
+    memcpy(hist, counts.channel[0], sizeof(counts.channel[0]));
+
+    // In palette mode pixel value v is shown as pending[v]
+    if (img->paletteMode) {
+        unsigned int shown[256] = {0};
+        for (int i = 0; i < 256; i++) shown[img->pending[i]] += hist[i];
+        memcpy(hist, shown, sizeof(shown));
     }
 
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
     return hist;
 }
 
@@ -22,74 +70,48 @@ unsigned int *bmp8_computeHistogram(t_bmp8 *img) {
 unsigned int *bmp8_computeCDF(unsigned int *hist) {
     unsigned int *cdf = malloc(256 * sizeof(unsigned int));
     if (!cdf) {
-        printf("Memory allocation failed.\n");
+        imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
         return NULL;
     }
 
-    cdf[0] = hist[0];
-    for (int i = 1; i < 256; i++) {
-        cdf[i] = cdf[i - 1] + hist[i];
-    }
-
+    hist_cumulate(hist, cdf);
     return cdf;
 }
 
 // Apply histogram equalization to an 8-bit BMP image
-void bmp8_equalize(t_bmp8 *img, unsigned int *cdf) {
-    unsigned char map[256];
-    unsigned int totalPixels = img->width * img->height;
-
-    unsigned int cdf_min = 0;
-    for (int i = 0; i < 256; i++) {
-        if (cdf[i] != 0) {
-            cdf_min = cdf[i];
-            break;
-        }
-    }
-
-    printf("\nCDF Preview\n");
-    for (int i = 0; i < 256; i += 32) {
-        printf("cdf[%3d] = %u\n", i, cdf[i]);
-    }
-
-    for (int i = 0; i < 256; i++) {
-        map[i] = (unsigned char) roundf(((float)(cdf[i] - cdf_min) / (totalPixels - cdf_min)) * 255.0f);
-    }
-
-    printf("\nLUT Mapping\n");
-    for (int i = 0; i < 256; i += 32) {
-        printf("map[%3d] = %d\n", i, map[i]);
-    }
-
-    printf("\nSample pixel values\n");
-    for (int i = 0; i < 10; i++) {
-        unsigned char old = img->data[i];
-        unsigned char new = map[old];
-        printf("Pixel[%d]: %d -> %d\n", i, old, new);
-    }
-
-    for (unsigned int i = 0; i < img->dataSize; i++) {
-        img->data[i] = map[img->data[i]];
-    }
+int bmp8_equalize(t_bmp8 *img, unsigned int *cdf) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_lut lut;
+    lut_identity(&lut);
+    lut_equalize(&lut, -1, cdf, img->width * img->height);
+    bmp8_applyLUT(img, &lut);
+    trace_end(&span, __func__, 0);
+    return 0;
 }
 
-// Load an 8-bit BMP image from a file
-t_bmp8 *bmp8_loadImage(const char *filename) {
+// Read an 8-bit BMP image from a file
+static t_bmp8 *bmp8_readFile(const char *filename) {
     FILE *f = fopen(filename, "rb");
     if (!f) {
-        printf("Unable to open file %s\n", filename);
+        imgfun_fail(IMGFUN_ERROR_OPEN, "Unable to open file %s", filename);
         return NULL;
     }
 
     t_bmp8 *img = malloc(sizeof(t_bmp8));
     if (!img) {
         fclose(f);
-        printf("Memory allocation failed\n");
+        imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed");
         return NULL;
     }
+    img->mapping = NULL;
+    img->mappingSize = 0;
+    img->paletteMode = 0;
+    img->back = NULL;
+    img->inPlace = 0;
 
     if (fread(img->header, sizeof(unsigned char), 54, f) != 54) {
-        printf("Couldn't read BMP header.\n");
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
         free(img);
         fclose(f);
         return NULL;
@@ -101,34 +123,36 @@ t_bmp8 *bmp8_loadImage(const char *filename) {
     img->dataSize    = *(unsigned int *)&img->header[34];
 
     if (img->colorDepth != 8) {
-        printf("Only 8-bit grayscale images are supported.\n");
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Only 8-bit grayscale images are supported.");
         free(img);
         fclose(f);
         return NULL;
     }
 
     if (fread(img->colorTable, sizeof(unsigned char), 1024, f) != 1024) {
-        printf("Color palette read error.\n");
+        imgfun_fail(IMGFUN_ERROR_READ, "Color palette read error.");
         free(img);
         fclose(f);
         return NULL;
     }
 
-    if (img->dataSize == 0) {
-        int rowSize = ((img->width + 3) / 4) * 4;
-        img->dataSize = rowSize * img->height;
+    if (bmp8_checkSize(img) != 0) {
+        free(img);
+        fclose(f);
+        return NULL;
     }
 
-    img->data = malloc(img->dataSize);
+    // Same kind of buffer as the filter output, since filters swap the two
+    img->data = bmp_takeScratch(img->dataSize);
     if (!img->data) {
-        printf("Memory allocation failed.\n");
+        imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
         free(img);
         fclose(f);
         return NULL;
     }
 
     if (fread(img->data, sizeof(unsigned char), img->dataSize, f) != img->dataSize) {
-        printf("Pixel read failed.\n");
+        imgfun_fail(IMGFUN_ERROR_READ, "Pixel read failed.");
         free(img->data);
         free(img);
         fclose(f);
@@ -136,148 +160,476 @@ t_bmp8 *bmp8_loadImage(const char *filename) {
     }
 
     fclose(f);
+    trace_count(TRACE_BYTES_READ, 54 + 1024 + (unsigned long long)img->dataSize);
     return img;
 }
 
-// Save an 8-bit BMP image to a file
-void bmp8_saveImage(const char *filename, t_bmp8 *img) {
-    FILE *f = fopen(filename, "wb");
+// Load an 8-bit BMP image from a file
+t_bmp8 *bmp8_loadImage(const char *filename) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_bmp8 *img = bmp8_readFile(filename);
+    trace_end(&span, __func__, img ? (unsigned long long)img->width * img->height : 0);
+    return img;
+}
+
+// Build an 8-bit BMP image on top of a private, writable file mapping
+t_bmp8 *bmp8_fromMapping(void *mapping, size_t size) {
+    const unsigned char *file = mapping;
+    if (size < 54 + 1024) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    t_bmp8 *img = malloc(sizeof(t_bmp8));
+    if (!img) {
+        imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed");
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    memcpy(img->header, file, 54);
+    memcpy(img->colorTable, file + 54, 1024);
+    img->width       = *(unsigned int *)&img->header[18];
+    img->height      = *(unsigned int *)&img->header[22];
+    img->colorDepth  = *(unsigned short *)&img->header[28];
+    img->dataSize    = *(unsigned int *)&img->header[34];
+    unsigned int offset = *(unsigned int *)&img->header[10];
+
+    if (img->colorDepth != 8) {
+        imgfun_fail(IMGFUN_ERROR_FORMAT, "Only 8-bit grayscale images are supported.");
+        free(img);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    if (bmp8_checkSize(img) != 0) {
+        free(img);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    if (offset < 54 + 1024 || offset > size || size - offset < img->dataSize) {
+        imgfun_fail(IMGFUN_ERROR_READ, "Pixel read failed.");
+        free(img);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    img->mapping = mapping;
+    img->mappingSize = size;
+    img->paletteMode = 0;
+    img->data = (unsigned char *)mapping + offset;
+    img->back = NULL;
+    img->inPlace = 0;
+    return img;
+}
+
+// Load an 8-bit BMP image by mapping the file into memory
+t_bmp8 *bmp8_mapImage(const char *filename) {
+    t_traceSpan span;
+    trace_begin(&span);
+    size_t size;
+    void *mapping = bmp_mapFile(filename, &size);
+    t_bmp8 *img = mapping ? bmp8_fromMapping(mapping, size) : NULL;
+    trace_end(&span, __func__, 0);
+    return img;
+}
+
+// Allocate a black 8-bit image with a grayscale palette
+t_bmp8 *bmp8_allocate(int width, int height) {
+    if (width <= 0 || height <= 0) return NULL;
+
+    t_bmp8 *img = calloc(1, sizeof(t_bmp8));
+    if (!img) return NULL;
+
+    img->width = (unsigned int)width;
+    img->height = (unsigned int)height;
+    img->colorDepth = 8;
+    size_t rows = (size_t)bmp8_rowSize(img) * img->height;
+    if (rows > UINT_MAX - 54 - 1024) {
+        free(img);
+        return NULL;
+    }
+    img->dataSize = (unsigned int)rows;
+
+    // Same kind of buffer as the filter output, since filters swap the two
+    img->data = bmp_takeScratch(img->dataSize);
+    if (!img->data) {
+        free(img);
+        return NULL;
+    }
+    memset(img->data, 0, img->dataSize);
+
+    unsigned char *header = img->header;
+    bmp_writeU16(&header[0], 0x4D42);                      // Type
+    bmp_writeU32(&header[2], 54 + 1024 + img->dataSize);   // File size
+    bmp_writeU32(&header[10], 54 + 1024);                  // Pixel offset
+    bmp_writeU32(&header[14], 40);                         // Info header size
+    bmp_writeU32(&header[18], img->width);
+    bmp_writeU32(&header[22], img->height);
+    bmp_writeU16(&header[26], 1);                          // Planes
+    bmp_writeU16(&header[28], 8);                          // Bits per pixel
+    bmp_writeU32(&header[34], img->dataSize);
+    bmp_writeU32(&header[38], 2835);                       // Horizontal resolution
+    bmp_writeU32(&header[42], 2835);                       // Vertical resolution
+    for (int i = 0; i < 256; i++) {
+        memset(img->colorTable + 4 * i, i, 3);
+    }
+    return img;
+}
+
+// Write an 8-bit BMP image to a file
+static int bmp8_writeFile(const char *filename, t_bmp8 *img) {
+    // A mapped image may be saved over its own file: truncating that file would take
+    // away the pages the mapping still shares, so write a new file and rename it
+    char *path = malloc(strlen(filename) + 5);
+    if (!path) {
+        return imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
+    }
+    strcpy(path, filename);
+    if (img->mapping) strcat(path, ".tmp");
+
+    FILE *f = fopen(path, "wb");
     if (!f) {
-        printf("Save error (no spaces in name): %s\n", filename);
-        return;
+        free(path);
+        return imgfun_fail(IMGFUN_ERROR_WRITE, "Save error (no spaces in name): %s", filename);
     }
 
-    fwrite(img->header, sizeof(unsigned char), 54, f);
-    fwrite(img->colorTable, sizeof(unsigned char), 1024, f);
-    fwrite(img->data, sizeof(unsigned char), img->dataSize, f);
+    int ok = fwrite(img->header, sizeof(unsigned char), 54, f) == 54
+             && fwrite(img->colorTable, sizeof(unsigned char), 1024, f) == 1024
+             && fwrite(img->data, sizeof(unsigned char), img->dataSize, f) == img->dataSize;
+    if (fclose(f) != 0) ok = 0;
+    if (ok && img->mapping && rename(path, filename) != 0) ok = 0;
+    if (!ok && img->mapping) remove(path);
+    free(path);
+    if (!ok) {
+        return imgfun_fail(IMGFUN_ERROR_WRITE, "Save error: %s", filename);
+    }
+    trace_count(TRACE_BYTES_WRITTEN, 54 + 1024 + (unsigned long long)img->dataSize);
+    return 0;
+}
 
-    printf("Image saved in %s\n", filename);
-    fclose(f);
+// Save an 8-bit BMP image to a file
+int bmp8_saveImage(const char *filename, t_bmp8 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int status = bmp8_writeFile(filename, img);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Tell whether p points into the file mapping of the image
+static int bmp8_isMapped(const t_bmp8 *img, const unsigned char *p) {
+    const unsigned char *mapping = img->mapping;
+    return mapping && p >= mapping && p < mapping + img->mappingSize;
 }
 
 // Free memory allocated for an 8-bit BMP image
 void bmp8_free(t_bmp8 *img) {
     if (img) {
-        free(img->data);
+        // After an odd number of filters the pixels are on the heap and the
+        // back buffer is in the mapping
+        if (!bmp8_isMapped(img, img->data)) free(img->data);
+        if (!bmp8_isMapped(img, img->back)) bmp_giveScratch(img->back, img->dataSize);
+        if (img->mapping) munmap(img->mapping, img->mappingSize);
         free(img);
     }
 }
 
-// Print information about an 8-bit BMP image
-void bmp8_printInfo(const t_bmp8 *img) {
-    printf("\nImage information:\n");
-    printf("Width        : %u pixels\n", img->width);
-    printf("Height       : %u pixels\n", img->height);
-    printf("Color Depth  : %u bits\n", img->colorDepth);
-    printf("Image Size   : %u bytes\n", img->dataSize);
+// Show every pixel value v with the color base entry pending[v] had
+static void bmp8_updatePalette(t_bmp8 *img) {
+    for (int i = 0; i < 256; i++) {
+        memcpy(img->colorTable + 4 * i, img->baseTable + 4 * img->pending[i], 4);
+    }
 }
 
-// Apply a negative effect to an 8-bit BMP image
-void bmp8_negative(t_bmp8 *img) {
-    for (unsigned int i = 0; i < img->dataSize; i++) {
-        img->data[i] = 255 - img->data[i];
+// Turn palette mode on or off
+void bmp8_setPaletteMode(t_bmp8 *img, int enabled) {
+    if (enabled && !img->paletteMode) {
+        memcpy(img->baseTable, img->colorTable, sizeof(img->baseTable));
+        for (int i = 0; i < 256; i++) img->pending[i] = (unsigned char)i;
+        img->paletteMode = 1;
+    } else if (!enabled && img->paletteMode) {
+        bmp8_bakePalette(img);
+        img->paletteMode = 0;
     }
 }
 
-// Adjust the brightness of an 8-bit BMP image
-void bmp8_brightness(t_bmp8 *img, int value) {
-    for (unsigned int i = 0; i < img->dataSize; i++) {
-        int temp = img->data[i] + value;
-        img->data[i] = (temp > 255) ? 255 : (temp < 0 ? 0 : (unsigned char)temp);
+// Write the pixel map pending in the palette into the pixels
+void bmp8_bakePalette(t_bmp8 *img) {
+    if (!img->paletteMode) return;
+
+    t_lut lut;
+    lut_identity(&lut);
+    lut_map(&lut, 0, img->pending);
+    t_raster raster = bmp8_raster(img, img->data);
+    lut_apply(&lut, &raster);
+
+    for (int i = 0; i < 256; i++) img->pending[i] = (unsigned char)i;
+    memcpy(img->colorTable, img->baseTable, sizeof(img->colorTable));
+}
+
+// Run every pixel of an 8-bit BMP image through a lookup table in one pass
+void bmp8_applyLUT(t_bmp8 *img, const t_lut *lut) {
+    t_traceSpan span;
+    trace_begin(&span);
+    if (img->paletteMode) {
+        // O(256): compose into the pending map and only rewrite the palette
+        for (int i = 0; i < 256; i++) img->pending[i] = lut->table[0][img->pending[i]];
+        bmp8_updatePalette(img);
+        trace_end(&span, __func__, 0);
+        return;
     }
+    t_raster raster = bmp8_raster(img, img->data);
+    lut_apply(lut, &raster);
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+}
+
+// Apply a negative effect to an 8-bit BMP image
+int bmp8_negative(t_bmp8 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_lut lut;
+    lut_identity(&lut);
+    lut_negative(&lut);
+    bmp8_applyLUT(img, &lut);
+    trace_end(&span, __func__, 0);
+    return 0;
+}
+
+// Adjust the brightness of an 8-bit BMP image
+int bmp8_brightness(t_bmp8 *img, int value) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_lut lut;
+    lut_identity(&lut);
+    lut_brightness(&lut, value);
+    bmp8_applyLUT(img, &lut);
+    trace_end(&span, __func__, 0);
+    return 0;
 }
 
 // Apply a threshold effect to an 8-bit BMP image
-void bmp8_threshold(t_bmp8 *img, int threshold) {
-    for (unsigned int i = 0; i < img->dataSize; i++) {
-        img->data[i] = (img->data[i] >= threshold) ? 255 : 0;
+int bmp8_threshold(t_bmp8 *img, int threshold) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_lut lut;
+    lut_identity(&lut);
+    lut_threshold(&lut, threshold);
+    bmp8_applyLUT(img, &lut);
+    trace_end(&span, __func__, 0);
+    return 0;
+}
+
+// Get the back buffer of the image (allocated by its first filter only) and
+// describe both buffers as rasters. Returns 0 or an IMGFUN_ERROR_ code.
+static int bmp8_beginFilter(t_bmp8 *img, t_raster *src, t_raster *dst) {
+    // Filters need the values the pixels show, not their palette indices
+    bmp8_bakePalette(img);
+
+    if (!img->back) {
+        img->back = bmp_takeScratch(img->dataSize);
+        if (!img->back) {
+            return imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
+        }
+        // Filters only write pixels: the row padding and anything after the last
+        // row are copied once, so both buffers save the same file
+        unsigned int rowSize = bmp8_rowSize(img);
+        for (unsigned int y = 0; y < img->height && rowSize > img->width; y++) {
+            memcpy(img->back + y * rowSize + img->width, img->data + y * rowSize + img->width,
+                   rowSize - img->width);
+        }
+        size_t rows = (size_t)rowSize * img->height;
+        if (img->dataSize > rows) memcpy(img->back + rows, img->data + rows, img->dataSize - rows);
     }
+    *src = bmp8_raster(img, img->data);
+    *dst = bmp8_raster(img, img->back);
+    return 0;
 }
 
-// Apply a convolution filter to an 8-bit BMP image
-void bmp8_applyFilter(t_bmp8 *img, float **kernel, int kernelSize) {
-    int n = kernelSize / 2;
-    unsigned char *newData = malloc(img->dataSize);
-    if (!newData) {
-        printf("Memory allocation failed.\n");
-        return;
+// Swap the back buffer in when the filter succeeded (status 0): the replaced pixels
+// become the output buffer of the next filter. Returns 0 or an IMGFUN_ERROR_ code.
+static int bmp8_endFilter(t_bmp8 *img, int status) {
+    if (status != 0) {
+        return imgfun_fail(IMGFUN_ERROR_MEMORY, "Filter failed.");
     }
+    unsigned char *newData = img->back;
+    img->back = img->data;
+    img->data = newData;
+    return 0;
+}
+
+// Apply a convolution filter to an 8-bit BMP image
+int bmp8_applyFilter(t_bmp8 *img, float **kernel, int kernelSize) {
+    return bmp8_applyFilterEdge(img, kernel, kernelSize, CONV_EDGE_ZERO);
+}
+
+// Turn in-place filtering on or off
+void bmp8_setInPlace(t_bmp8 *img, int enabled) {
+    img->inPlace = enabled;
+}
 
-    for (unsigned int y = 0; y < img->height; y++) {
-        for (unsigned int x = 0; x < img->width; x++) {
-            float pixel = 0.0f;
-            for (int ky = -n; ky <= n; ky++) {
-                for (int kx = -n; kx <= n; kx++) {
-                    int ix = x + kx;
-                    int iy = y + ky;
-                    if (ix >= 0 && ix < (int)img->width && iy >= 0 && iy < (int)img->height) {
-                        pixel += img->data[iy * img->width + ix] * kernel[ky + n][kx + n];
-                    }
-                }
-            }
-            if (pixel < 0) pixel = 0;
-            if (pixel > 255) pixel = 255;
-            newData[y * img->width + x] = (unsigned char)roundf(pixel);
+// Apply a convolution filter to an 8-bit BMP image with the given edge mode
+int bmp8_applyFilterEdge(t_bmp8 *img, float **kernel, int kernelSize, t_convEdge edge) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int status;
+    if (img->inPlace) {
+        bmp8_bakePalette(img);
+        t_raster raster = bmp8_raster(img, img->data);
+        status = conv_applyInPlace(&raster, kernel, kernelSize, CONV_ROUND, edge);
+        if (status != 0) status = imgfun_fail(IMGFUN_ERROR_MEMORY, "Filter failed.");
+    } else {
+        t_raster src, dst;
+        status = bmp8_beginFilter(img, &src, &dst);
+        if (status == 0) {
+            status = bmp8_endFilter(img, conv_apply(&src, &dst, kernel, kernelSize,
+                                                    CONV_ROUND, edge));
         }
     }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
+}
 
-    for (unsigned int i = 0; i < img->dataSize; i++) {
-        img->data[i] = newData[i];
+// Apply a separable filter (horizontal and vertical 1D kernels) to an 8-bit BMP image
+int bmp8_applySeparableFilter(t_bmp8 *img, const float *row, const float *column, int kernelSize,
+                              t_convEdge edge) {
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp8_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp8_endFilter(img, conv_applySeparable(&src, &dst, row, column, kernelSize,
+                                                         CONV_ROUND, edge));
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
+}
+
+// Apply an integer filter (weights / divisor) to an 8-bit BMP image
+int bmp8_applyIntFilter(t_bmp8 *img, const int *weights, int kernelSize, int divisor,
+                        t_convEdge edge) {
+    t_intKernel kernel;
+    if (kernelSize < 1 || kernelSize > CONV_MAX_INT_KERNEL || divisor < 1) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported integer kernel.");
+    }
+    kernel.size = kernelSize;
+    kernel.divisor = divisor;
+    memcpy(kernel.weights, weights, kernelSize * kernelSize * sizeof(int));
+
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp8_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp8_endFilter(img, conv_applyInt(&src, &dst, &kernel, CONV_ROUND, edge));
     }
-    free(newData);
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
 
 // Apply a box blur filter to an 8-bit BMP image
-void bmp8_boxBlur(t_bmp8 *img) {
-    float box[3][3] = {
-        {1/9.f, 1/9.f, 1/9.f},
-        {1/9.f, 1/9.f, 1/9.f},
-        {1/9.f, 1/9.f, 1/9.f}
-    };
-    float* kernel[3] = { box[0], box[1], box[2] };
-    bmp8_applyFilter(img, kernel, 3);
+int bmp8_boxBlur(t_bmp8 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_BOX, kernel);
+    int status = bmp8_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Apply a box blur of any radius to an 8-bit BMP image
+int bmp8_boxBlurRadius(t_bmp8 *img, int radius, t_convEdge edge) {
+    if (radius < 0 || radius > CONV_MAX_BOX_RADIUS) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported blur radius.");
+    }
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp8_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp8_endFilter(img, conv_boxBlur(&src, &dst, radius, CONV_ROUND, edge));
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
 
 // Apply a Gaussian blur filter to an 8-bit BMP image
-void bmp8_gaussianBlur(t_bmp8 *img) {
-    float gauss[3][3] = {
-        {1/16.f, 2/16.f, 1/16.f},
-        {2/16.f, 4/16.f, 2/16.f},
-        {1/16.f, 2/16.f, 1/16.f}
-    };
-    float* kernel[3] = { gauss[0], gauss[1], gauss[2] };
-    bmp8_applyFilter(img, kernel, 3);
+int bmp8_gaussianBlur(t_bmp8 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_GAUSSIAN, kernel);
+    int status = bmp8_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Apply a Gaussian blur of any standard deviation to an 8-bit BMP image
+int bmp8_gaussianBlurSigma(t_bmp8 *img, float sigma, t_convEdge edge) {
+    if (!(sigma > 0.0f) || sigma > CONV_MAX_SIGMA) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported blur sigma.");
+    }
+    t_traceSpan span;
+    trace_begin(&span);
+    t_raster src, dst;
+    int status = bmp8_beginFilter(img, &src, &dst);
+    if (status == 0) {
+        status = bmp8_endFilter(img, conv_gaussianBlur(&src, &dst, sigma, CONV_ROUND, edge));
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
 
 // Apply an outline filter to an 8-bit BMP image
-void bmp8_outline(t_bmp8 *img) {
-    float outline[3][3] = {
-        {-1, -1, -1},
-        {-1,  8, -1},
-        {-1, -1, -1}
-    };
-    float* kernel[3] = { outline[0], outline[1], outline[2] };
-    bmp8_applyFilter(img, kernel, 3);
+int bmp8_outline(t_bmp8 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_OUTLINE, kernel);
+    int status = bmp8_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
 }
 
 // Apply an emboss filter to an 8-bit BMP image
-void bmp8_emboss(t_bmp8 *img) {
-    float emboss[3][3] = {
-        {-2, -1, 0},
-        {-1,  1, 1},
-        { 0,  1, 2}
-    };
-    float* kernel[3] = { emboss[0], emboss[1], emboss[2] };
-    bmp8_applyFilter(img, kernel, 3);
+int bmp8_emboss(t_bmp8 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_EMBOSS, kernel);
+    int status = bmp8_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
 }
 
 // Apply a sharpen filter to an 8-bit BMP image
-void bmp8_sharpen(t_bmp8 *img) {
-    float sharpen[3][3] = {
-        { 0, -1,  0},
-        {-1,  5, -1},
-        { 0, -1,  0}
-    };
-    float* kernel[3] = { sharpen[0], sharpen[1], sharpen[2] };
-    bmp8_applyFilter(img, kernel, 3);
+int bmp8_sharpen(t_bmp8 *img) {
+    t_traceSpan span;
+    trace_begin(&span);
+    float *kernel[CONV_STOCK_SIZE];
+    conv_stockRows(CONV_STOCK_SHARPEN, kernel);
+    int status = bmp8_applyFilter(img, kernel, CONV_STOCK_SIZE);
+    trace_end(&span, __func__, 0);
+    return status;
+}
+
+// Apply contrast-limited adaptive histogram equalization to an 8-bit BMP image
+int bmp8_clahe(t_bmp8 *img, int tileSize, float clipLimit) {
+    if (tileSize < HIST_MIN_TILE) {
+        return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported tile size.");
+    }
+    t_traceSpan span;
+    trace_begin(&span);
+    bmp8_bakePalette(img);
+    t_raster raster = bmp8_raster(img, img->data);
+    int status = 0;
+    if (hist_clahe(&raster, tileSize, clipLimit) != 0) {
+        status = imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
+    }
+    trace_end(&span, __func__, (unsigned long long)img->width * img->height);
+    return status;
 }
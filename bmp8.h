@@ -1,63 +1,132 @@
 #ifndef BMP8_H
 #define BMP8_H
+#include <stddef.h>
+#include "convolution.h"
+#include "pointwise.h"
 
 // Structure representing an 8-bit BMP image
 typedef struct {
     unsigned char header[54];      // BMP file header
     unsigned char colorTable[1024]; // Color table for 8-bit images
     unsigned char *data;           // Pixel data
+    unsigned char *back;           // Output buffer of the filters, swapped with data after each one
     unsigned int width;            // Width of the image
     unsigned int height;           // Height of the image
     unsigned short colorDepth;     // Color depth of the image
     unsigned int dataSize;         // Size of the pixel data
+    void *mapping;                 // File mapping data points into, NULL if data is on the heap
+    size_t mappingSize;            // Size of the file mapping in bytes
+    int paletteMode;               // Non-zero when pointwise operations only rewrite colorTable
+    unsigned char pending[256];    // Palette mode: pixel map not yet written into data
+    unsigned char baseTable[1024]; // Palette mode: colorTable as it was when the mode was entered
+    int inPlace;                   // Non-zero when kernel filters write back into data
 } t_bmp8;
 
 // Function to load an 8-bit BMP image from a file
 t_bmp8 *bmp8_loadImage(const char *filename);
 
-// Function to save an 8-bit BMP image to a file
-void bmp8_saveImage(const char *filename, t_bmp8 *img);
+// Function to load an 8-bit BMP image by mapping the file into memory.
+// Pixels are not copied: they are shared with the page cache until first written.
+t_bmp8 *bmp8_mapImage(const char *filename);
 
-// Function to free memory allocated for an 8-bit BMP image
+// Function to build an 8-bit BMP image on top of a private, writable file mapping.
+// The image takes ownership of the mapping (it is unmapped on failure too).
+t_bmp8 *bmp8_fromMapping(void *mapping, size_t size);
+
+// Function to allocate a black 8-bit image with a grayscale palette.
+// Returns NULL if a side is not positive or memory runs out.
+t_bmp8 *bmp8_allocate(int width, int height);
+
+// Function to save an 8-bit BMP image to a file. Returns 0, or an IMGFUN_ERROR_ code.
+int bmp8_saveImage(const char *filename, t_bmp8 *img);
+
+// Function to free memory allocated for an 8-bit BMP image. The filter output buffer is
+// handed to bmp_giveScratch, so the next image of the same size reuses it.
 void bmp8_free(t_bmp8 *img);
 
-// Function to print information about an 8-bit BMP image
-void bmp8_printInfo(const t_bmp8 *img);
+// Function to run every pixel of an 8-bit BMP image through a lookup table in one pass.
+// Build the table with the lut_ functions to chain several adjustments for the cost of one.
+void bmp8_applyLUT(t_bmp8 *img, const t_lut *lut);
+
+// Function to turn palette mode on or off. In palette mode applyLUT, negative, brightness,
+// threshold and equalize rewrite the 256 colorTable entries instead of every pixel, and the
+// saved file looks the same. Pixel filters bake the palette first; turning the mode off bakes too.
+void bmp8_setPaletteMode(t_bmp8 *img, int enabled);
+
+// Function to write the changes pending in the palette into the pixels and restore the palette.
+// The image stays in palette mode. Does nothing in pixel mode.
+void bmp8_bakePalette(t_bmp8 *img);
+
+// Function to turn in-place filtering on or off. In-place, applyFilter and the 3x3 filters
+// write their result back into data, holding only a few rows aside instead of a second
+// image, with the same output. The other filters still use the back buffer.
+void bmp8_setInPlace(t_bmp8 *img, int enabled);
+
+// The effects, filters, equalization and CLAHE below return 0, or an IMGFUN_ERROR_ code
 
 // Function to apply a negative effect to an 8-bit BMP image
-void bmp8_negative(t_bmp8 *img);
+int bmp8_negative(t_bmp8 *img);
 
 // Function to adjust the brightness of an 8-bit BMP image
-void bmp8_brightness(t_bmp8 *img, int value);
+int bmp8_brightness(t_bmp8 *img, int value);
 
 // Function to apply a threshold effect to an 8-bit BMP image
-void bmp8_threshold(t_bmp8 *img, int threshold);
+int bmp8_threshold(t_bmp8 *img, int threshold);
 
-// Function to apply a convolution filter to an 8-bit BMP image
-void bmp8_applyFilter(t_bmp8 *img, float **kernel, int kernelSize);
+// Function to apply a convolution filter to an 8-bit BMP image (pixels outside count as 0)
+int bmp8_applyFilter(t_bmp8 *img, float **kernel, int kernelSize);
+
+// Function to apply a convolution filter with the given handling of taps outside the image.
+// CONV_EDGE_CLAMP or CONV_EDGE_MIRROR avoid the dark frame zero padding leaves on blurs.
+int bmp8_applyFilterEdge(t_bmp8 *img, float **kernel, int kernelSize, t_convEdge edge);
+
+// Function to apply a separable filter given as a horizontal and a vertical 1D kernel.
+// Costs 2k taps per pixel instead of k*k; applyFilter uses it for rank-1 kernels.
+int bmp8_applySeparableFilter(t_bmp8 *img, const float *row, const float *column, int kernelSize,
+                              t_convEdge edge);
+
+// Function to apply an integer filter: each pixel becomes sum(weight * pixel) / divisor.
+// weights holds kernelSize * kernelSize values, row by row; fixed-point kernels with
+// n fractional bits use divisor = 1 << n. Runs entirely in integer arithmetic.
+int bmp8_applyIntFilter(t_bmp8 *img, const int *weights, int kernelSize, int divisor,
+                        t_convEdge edge);
 
 // Function to apply a box blur filter to an 8-bit BMP image
-void bmp8_boxBlur(t_bmp8 *img);
+int bmp8_boxBlur(t_bmp8 *img);
+
+// Function to apply a box blur of any radius ((2 * radius + 1)^2 pixels) to an 8-bit BMP image.
+// Uses running sums, so a large radius costs the same per pixel as radius 1.
+int bmp8_boxBlurRadius(t_bmp8 *img, int radius, t_convEdge edge);
 
 // Function to apply a Gaussian blur filter to an 8-bit BMP image
-void bmp8_gaussianBlur(t_bmp8 *img);
+int bmp8_gaussianBlur(t_bmp8 *img);
+
+// Function to apply a Gaussian blur of any standard deviation to an 8-bit BMP image.
+// Runs in constant time per pixel; see conv_gaussianBlur for the accuracy.
+int bmp8_gaussianBlurSigma(t_bmp8 *img, float sigma, t_convEdge edge);
 
 // Function to apply an outline filter to an 8-bit BMP image
-void bmp8_outline(t_bmp8 *img);
+int bmp8_outline(t_bmp8 *img);
 
 // Function to apply an emboss filter to an 8-bit BMP image
-void bmp8_emboss(t_bmp8 *img);
+int bmp8_emboss(t_bmp8 *img);
 
 // Function to apply a sharpen filter to an 8-bit BMP image
-void bmp8_sharpen(t_bmp8 *img);
+int bmp8_sharpen(t_bmp8 *img);
 
-// Function to compute the histogram of an 8-bit BMP image
+// Function to compute the histogram of an 8-bit BMP image (of the values shown in palette mode)
 unsigned int *bmp8_computeHistogram(t_bmp8 *img);
 
 // Function to compute the Cumulative Distribution Function (CDF) from a histogram
 unsigned int *bmp8_computeCDF(unsigned int *hist);
 
 // Function to apply histogram equalization to an 8-bit BMP image
-void bmp8_equalize(t_bmp8 *img, unsigned int *cdf);
+int bmp8_equalize(t_bmp8 *img, unsigned int *cdf);
+
+// Function to apply contrast-limited adaptive histogram equalization to an 8-bit BMP image.
+// Equalizes each tileSize x tileSize tile on its own (HIST_CLAHE_TILE is a good start) with its
+// histogram clipped at clipLimit times the mean (HIST_CLAHE_CLIP; <= 0 means no limit), and
+// blends neighboring tiles so no seams show. Evens out unevenly lit scans.
+int bmp8_clahe(t_bmp8 *img, int tileSize, float clipLimit);
 
 #endif // BMP8_H
@@ -0,0 +1,592 @@
+#include "cli.h"
+#include "imgfun.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+
+// Longest line accepted in a batch file list
+#define CLI_MAX_PATH 4096
+
+// Operations of the command-line pipeline
+typedef enum {
+    OP_NEGATIVE, OP_GRAYSCALE, OP_BRIGHTNESS, OP_THRESHOLD, OP_BOX_BLUR, OP_GAUSSIAN,
+    OP_OUTLINE, OP_EMBOSS, OP_SHARPEN, OP_EQUALIZE, OP_CLAHE
+} t_opKind;
+
+// Command-line name of an operation and the color depths it exists for
+typedef struct {
+    const char *name;
+    t_opKind kind;
+    int depths;         // 8, 24, or 0 for both
+} t_opInfo;
+
+static const t_opInfo cli_operations[] = {
+    { "negative", OP_NEGATIVE, 0 },
+    { "grayscale", OP_GRAYSCALE, 24 },
+    { "brightness", OP_BRIGHTNESS, 0 },
+    { "threshold", OP_THRESHOLD, 8 },
+    { "box-blur", OP_BOX_BLUR, 0 },
+    { "gaussian", OP_GAUSSIAN, 0 },
+    { "outline", OP_OUTLINE, 0 },
+    { "emboss", OP_EMBOSS, 0 },
+    { "sharpen", OP_SHARPEN, 0 },
+    { "equalize", OP_EQUALIZE, 0 },
+    { "clahe", OP_CLAHE, 0 },
+};
+
+// One step of the pipeline with its parsed argument
+typedef struct {
+    const t_opInfo *op;
+    int hasValue;       // Set when the option was given a value (--name=value)
+    int value;          // Brightness, threshold, blur radius or CLAHE tile size
+    float amount;       // Gaussian sigma or CLAHE clip limit
+    t_convEdge edge;    // Edge mode of the filters, from the last --edge before the step
+} t_step;
+
+// Print how to use the command-line mode
+static void cli_printUsage(FILE *out) {
+    fprintf(out,
+            "Usage: ImgFun INPUT.bmp [OPTIONS] OPERATION... -o OUTPUT.bmp\n"
+            "       ImgFun --batch DIRECTORY|LIST [OPTIONS] OPERATION... -o OUTPUT_DIRECTORY\n"
+            "       ImgFun              (interactive menus)\n"
+            "Operations, run in the order given:\n"
+            "  --negative  --grayscale (24-bit)  --brightness=N  --threshold=N (8-bit)\n"
+            "  --box-blur[=RADIUS]  --gaussian[=SIGMA]  --outline  --emboss  --sharpen\n"
+            "  --equalize  --clahe[=TILE[,CLIP]]\n"
+            "Options:\n"
+            "  --edge=zero|clamp|mirror|wrap  edges of the blurs that follow (default zero)\n"
+            "  --palette      8-bit: apply pointwise operations to the palette only\n"
+            "  --in-place     3x3 filters write back into the image instead of a copy\n"
+            "  --stream       process the image a strip of rows at a time, for images\n"
+            "                 larger than memory (no blur radius or sigma, no --clahe)\n"
+            "  --threads=N    worker threads inside each image (0 = one per CPU)\n"
+            "  --batch        process every .bmp of a directory, or every path listed\n"
+            "                 in a text file (one per line), into the -o directory\n"
+            "  --jobs=N       images processed at once in a batch (0 = one per CPU)\n"
+            "Exit status: 0 ok, %d bad arguments, %d unreadable input, %d operation not\n"
+            "available for the image depth, %d output not written, %d some images of\n"
+            "a batch failed, %d an operation failed (the output is not written).\n",
+            CLI_EXIT_USAGE, CLI_EXIT_LOAD, CLI_EXIT_UNSUPPORTED, CLI_EXIT_SAVE, CLI_EXIT_BATCH,
+            CLI_EXIT_OPERATION);
+}
+
+// Parse a whole string as an integer in [min, max]. Returns 0 on success.
+static int cli_parseInt(const char *text, int min, int max, int *out) {
+    char *end;
+    long value = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || value < min || value > max) return -1;
+    *out = (int)value;
+    return 0;
+}
+
+// Parse a whole string as a float in (0, max]. Returns 0 on success.
+static int cli_parsePositive(const char *text, float max, float *out) {
+    char *end;
+    float value = strtof(text, &end);
+    if (end == text || *end != '\0' || !(value > 0.0f) || value > max) return -1;
+    *out = value;
+    return 0;
+}
+
+// Parse the value of an operation (the text after '='). Returns 0 on success.
+static int cli_parseStepValue(t_step *step, const char *value) {
+    step->hasValue = value != NULL;
+    switch (step->op->kind) {
+        case OP_BRIGHTNESS:
+            return value ? cli_parseInt(value, -255, 255, &step->value) : -1;
+        case OP_THRESHOLD:
+            return value ? cli_parseInt(value, 0, 255, &step->value) : -1;
+        case OP_BOX_BLUR:
+            return value ? cli_parseInt(value, 0, CONV_MAX_BOX_RADIUS, &step->value) : 0;
+        case OP_GAUSSIAN:
+            return value ? cli_parsePositive(value, CONV_MAX_SIGMA, &step->amount) : 0;
+        case OP_CLAHE: {
+            step->value = HIST_CLAHE_TILE;
+            step->amount = HIST_CLAHE_CLIP;
+            if (!value) return 0;
+            char tile[32];
+            const char *comma = strchr(value, ',');
+            size_t length = comma ? (size_t)(comma - value) : strlen(value);
+            if (length >= sizeof(tile)) return -1;
+            memcpy(tile, value, length);
+            tile[length] = '\0';
+            if (cli_parseInt(tile, HIST_MIN_TILE, 1 << 16, &step->value) != 0) return -1;
+            return comma ? cli_parsePositive(comma + 1, 256.0f, &step->amount) : 0;
+        }
+        default:
+            return value ? -1 : 0;
+    }
+}
+
+// Parse the edge mode of --edge=name. Returns 0 on success.
+static int cli_parseEdge(const char *name, t_convEdge *edge) {
+    static const char *names[] = { "zero", "clamp", "mirror", "wrap" };
+    static const t_convEdge modes[] = { CONV_EDGE_ZERO, CONV_EDGE_CLAMP, CONV_EDGE_MIRROR, CONV_EDGE_WRAP };
+    for (int i = 0; i < 4; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *edge = modes[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Run one step of the pipeline on an 8 bit image. Returns 0 or an IMGFUN_ERROR_ code.
+static int cli_runStep8(t_bmp8 *img, const t_step *step) {
+    switch (step->op->kind) {
+        case OP_NEGATIVE: return bmp8_negative(img);
+        case OP_BRIGHTNESS: return bmp8_brightness(img, step->value);
+        case OP_THRESHOLD: return bmp8_threshold(img, step->value);
+        case OP_BOX_BLUR:
+            if (step->hasValue) return bmp8_boxBlurRadius(img, step->value, step->edge);
+            return bmp8_boxBlur(img);
+        case OP_GAUSSIAN:
+            if (step->hasValue) return bmp8_gaussianBlurSigma(img, step->amount, step->edge);
+            return bmp8_gaussianBlur(img);
+        case OP_OUTLINE: return bmp8_outline(img);
+        case OP_EMBOSS: return bmp8_emboss(img);
+        case OP_SHARPEN: return bmp8_sharpen(img);
+        case OP_EQUALIZE: {
+            unsigned int *hist = bmp8_computeHistogram(img);
+            unsigned int *cdf = hist ? bmp8_computeCDF(hist) : NULL;
+            int status = cdf ? bmp8_equalize(img, cdf) : IMGFUN_ERROR_MEMORY;
+            free(hist);
+            free(cdf);
+            return status;
+        }
+        case OP_CLAHE: return bmp8_clahe(img, step->value, step->amount);
+        case OP_GRAYSCALE: break;
+    }
+    return 0;
+}
+
+// Run one step of the pipeline on a 24 bit image. Returns 0 or an IMGFUN_ERROR_ code.
+static int cli_runStep24(t_bmp24 *img, const t_step *step) {
+    switch (step->op->kind) {
+        case OP_NEGATIVE: return bmp24_negative(img);
+        case OP_GRAYSCALE: return bmp24_grayscale(img);
+        case OP_BRIGHTNESS: return bmp24_brightness(img, step->value);
+        case OP_BOX_BLUR:
+            if (step->hasValue) return bmp24_boxBlurRadius(img, step->value, step->edge);
+            return bmp24_boxBlur(img);
+        case OP_GAUSSIAN:
+            if (step->hasValue) return bmp24_gaussianBlurSigma(img, step->amount, step->edge);
+            return bmp24_gaussianBlur(img);
+        case OP_OUTLINE: return bmp24_outline(img);
+        case OP_EMBOSS: return bmp24_emboss(img);
+        case OP_SHARPEN: return bmp24_sharpen(img);
+        case OP_EQUALIZE: return bmp24_equalize(img);
+        case OP_CLAHE: return bmp24_clahe(img, step->value, step->amount);
+        case OP_THRESHOLD: break;
+    }
+    return 0;
+}
+
+// Parsed command line
+typedef struct {
+    t_step *steps;          // Operations in the order given
+    int count;
+    int palette;            // --palette
+    int stream;             // --stream
+    int inPlace;            // --in-place
+    int batch;              // --batch
+    int jobs;               // --jobs, 0 = one per CPU
+    int threads;            // --threads, -1 when not given
+    const char *input;      // Image, or the directory or list of a batch
+    const char *output;     // Image, or the output directory of a batch
+} t_pipeline;
+
+// Parse the command line. Returns 0, -1 after printing the help, or an exit status.
+static int cli_parse(int argc, char **argv, t_pipeline *pipeline) {
+    t_convEdge edge = CONV_EDGE_ZERO;
+    pipeline->threads = -1;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            cli_printUsage(stdout);
+            return -1;
+        } else if (strcmp(arg, "-o") == 0 && i + 1 < argc) {
+            pipeline->output = argv[++i];
+        } else if (strncmp(arg, "--edge=", 7) == 0) {
+            if (cli_parseEdge(arg + 7, &edge) != 0) {
+                fprintf(stderr, "ImgFun: unknown edge mode '%s'\n", arg + 7);
+                return CLI_EXIT_USAGE;
+            }
+        } else if (strncmp(arg, "--threads=", 10) == 0) {
+            if (cli_parseInt(arg + 10, 0, 1024, &pipeline->threads) != 0) {
+                fprintf(stderr, "ImgFun: bad thread count '%s'\n", arg + 10);
+                return CLI_EXIT_USAGE;
+            }
+        } else if (strncmp(arg, "--jobs=", 7) == 0) {
+            if (cli_parseInt(arg + 7, 0, 1024, &pipeline->jobs) != 0) {
+                fprintf(stderr, "ImgFun: bad job count '%s'\n", arg + 7);
+                return CLI_EXIT_USAGE;
+            }
+        } else if (strcmp(arg, "--batch") == 0) {
+            pipeline->batch = 1;
+        } else if (strcmp(arg, "--palette") == 0) {
+            pipeline->palette = 1;
+        } else if (strcmp(arg, "--stream") == 0) {
+            pipeline->stream = 1;
+        } else if (strcmp(arg, "--in-place") == 0) {
+            pipeline->inPlace = 1;
+        } else if (strncmp(arg, "--", 2) == 0) {
+            // An operation, maybe with =value
+            const char *value = strchr(arg, '=');
+            size_t length = value ? (size_t)(value - arg - 2) : strlen(arg + 2);
+            const t_opInfo *op = NULL;
+            for (size_t k = 0; k < sizeof(cli_operations) / sizeof(cli_operations[0]); k++) {
+                if (strlen(cli_operations[k].name) == length
+                    && strncmp(arg + 2, cli_operations[k].name, length) == 0) {
+                    op = &cli_operations[k];
+                }
+            }
+            t_step *step = &pipeline->steps[pipeline->count];
+            step->op = op;
+            step->edge = edge;
+            if (!op || cli_parseStepValue(step, value ? value + 1 : NULL) != 0) {
+                fprintf(stderr, "ImgFun: %s option '%s'\n", op ? "bad value in" : "unknown", arg);
+                return CLI_EXIT_USAGE;
+            }
+            pipeline->count++;
+        } else if (!pipeline->input && arg[0] != '-') {
+            pipeline->input = arg;
+        } else {
+            fprintf(stderr, "ImgFun: unexpected argument '%s'\n", arg);
+            return CLI_EXIT_USAGE;
+        }
+    }
+    if (!pipeline->input || !pipeline->output) {
+        cli_printUsage(stderr);
+        return CLI_EXIT_USAGE;
+    }
+    if (pipeline->stream) {
+        for (int i = 0; i < pipeline->count; i++) {
+            const t_step *step = &pipeline->steps[i];
+            if (step->op->kind == OP_CLAHE || (step->hasValue && (step->op->kind == OP_BOX_BLUR
+                                                                  || step->op->kind == OP_GAUSSIAN))) {
+                fprintf(stderr, "ImgFun: --%s can't run with --stream\n", step->op->name);
+                return CLI_EXIT_USAGE;
+            }
+        }
+        if (pipeline->palette) {
+            fprintf(stderr, "ImgFun: --palette can't run with --stream\n");
+            return CLI_EXIT_USAGE;
+        }
+    }
+    return 0;
+}
+
+// Turn the steps into stream operations; consecutive pointwise steps share one table.
+// Returns the number of operations.
+static int cli_streamOps(const t_pipeline *pipeline, t_streamOp *ops) {
+    int count = 0;
+    for (int i = 0; i < pipeline->count; i++) {
+        const t_step *step = &pipeline->steps[i];
+        t_opKind kind = step->op->kind;
+        if (kind == OP_NEGATIVE || kind == OP_BRIGHTNESS || kind == OP_THRESHOLD) {
+            if (count == 0 || ops[count - 1].kind != STREAM_LUT) {
+                ops[count].kind = STREAM_LUT;
+                lut_identity(&ops[count++].lut);
+            }
+            t_lut *lut = &ops[count - 1].lut;
+            if (kind == OP_NEGATIVE) lut_negative(lut);
+            else if (kind == OP_BRIGHTNESS) lut_brightness(lut, step->value);
+            else lut_threshold(lut, step->value);
+            continue;
+        }
+
+        t_streamOp *op = &ops[count++];
+        op->kernelSize = CONV_STOCK_SIZE;
+        switch (kind) {
+            case OP_GRAYSCALE: op->kind = STREAM_GRAYSCALE; break;
+            case OP_EQUALIZE: op->kind = STREAM_EQUALIZE; break;
+            case OP_BOX_BLUR: op->kind = STREAM_KERNEL; op->kernel = conv_stockKernels[CONV_STOCK_BOX]; break;
+            case OP_GAUSSIAN: op->kind = STREAM_KERNEL; op->kernel = conv_stockKernels[CONV_STOCK_GAUSSIAN]; break;
+            case OP_OUTLINE: op->kind = STREAM_KERNEL; op->kernel = conv_stockKernels[CONV_STOCK_OUTLINE]; break;
+            case OP_EMBOSS: op->kind = STREAM_KERNEL; op->kernel = conv_stockKernels[CONV_STOCK_EMBOSS]; break;
+            case OP_SHARPEN: op->kind = STREAM_KERNEL; op->kernel = conv_stockKernels[CONV_STOCK_SHARPEN]; break;
+            default: count--; break;
+        }
+    }
+    return count;
+}
+
+// Run the pipeline over an image without loading it. Returns 0 or an exit status.
+static int cli_streamImage(const t_pipeline *pipeline, const char *input, const char *output,
+                           double *pixels) {
+    int width, height, depth;
+    if (stream_probe(input, &width, &height, &depth) != 0) {
+        fprintf(stderr, "ImgFun: couldn't load %s\n", input);
+        return CLI_EXIT_LOAD;
+    }
+    for (int i = 0; i < pipeline->count; i++) {
+        const t_opInfo *op = pipeline->steps[i].op;
+        if (op->depths != 0 && op->depths != depth) {
+            fprintf(stderr, "ImgFun: --%s only works on %d-bit images (%s)\n", op->name, op->depths,
+                    input);
+            return CLI_EXIT_UNSUPPORTED;
+        }
+    }
+
+    t_streamOp *ops = calloc(pipeline->count > 0 ? pipeline->count : 1, sizeof(t_streamOp));
+    if (!ops) return CLI_EXIT_LOAD;
+    int status = stream_process(input, output, ops, cli_streamOps(pipeline, ops));
+    free(ops);
+    if (status == IMGFUN_ERROR_WRITE) {
+        fprintf(stderr, "ImgFun: couldn't write %s\n", output);
+        return CLI_EXIT_SAVE;
+    }
+    if (status == IMGFUN_ERROR_MEMORY || status == IMGFUN_ERROR_ARGUMENT) {
+        fprintf(stderr, "ImgFun: couldn't process %s\n", input);
+        return CLI_EXIT_OPERATION;
+    }
+    if (status != 0) {
+        fprintf(stderr, "ImgFun: couldn't process %s\n", input);
+        return CLI_EXIT_LOAD;
+    }
+    *pixels += (double)width * height;
+    return 0;
+}
+
+// Load one image, run every operation in order and save it. Adds the pixels
+// processed to *pixels. Returns 0 or an exit status.
+static int cli_processImage(const t_pipeline *pipeline, const char *input, const char *output,
+                            double *pixels) {
+    if (pipeline->stream) return cli_streamImage(pipeline, input, output, pixels);
+
+    t_bmp img;
+    if (bmp_load(input, &img) != 0) {
+        fprintf(stderr, "ImgFun: couldn't load %s\n", input);
+        return CLI_EXIT_LOAD;
+    }
+
+    // Check the whole chain before touching the image
+    for (int i = 0; i < pipeline->count; i++) {
+        const t_opInfo *op = pipeline->steps[i].op;
+        if (op->depths != 0 && op->depths != img.colorDepth) {
+            fprintf(stderr, "ImgFun: --%s only works on %d-bit images (%s)\n", op->name, op->depths,
+                    input);
+            bmp_free(&img);
+            return CLI_EXIT_UNSUPPORTED;
+        }
+    }
+
+    // Stop at the first step that fails: the image is left half processed and not saved
+    int step = 0, failed = 0, saved = 0;
+    if (img.colorDepth == 8) {
+        if (pipeline->palette) bmp8_setPaletteMode(img.img8, 1);
+        bmp8_setInPlace(img.img8, pipeline->inPlace);
+        for (; !failed && step < pipeline->count; step++) {
+            failed = cli_runStep8(img.img8, &pipeline->steps[step]);
+        }
+        if (!failed) saved = bmp8_saveImage(output, img.img8);
+        *pixels += (double)img.img8->width * img.img8->height;
+    } else {
+        bmp24_setInPlace(img.img24, pipeline->inPlace);
+        for (; !failed && step < pipeline->count; step++) {
+            failed = cli_runStep24(img.img24, &pipeline->steps[step]);
+        }
+        if (!failed) saved = bmp24_saveImage(img.img24, output);
+        *pixels += (double)img.img24->width * img.img24->height;
+    }
+    bmp_free(&img);
+
+    if (failed) {
+        fprintf(stderr, "ImgFun: --%s failed on %s, %s not written\n",
+                pipeline->steps[step - 1].op->name, input, output);
+        return CLI_EXIT_OPERATION;
+    }
+    if (saved != 0) {
+        fprintf(stderr, "ImgFun: couldn't write %s\n", output);
+        return CLI_EXIT_SAVE;
+    }
+    return 0;
+}
+
+// Files of a batch and the progress shared by its workers
+typedef struct {
+    const t_pipeline *pipeline;
+    char **files;
+    int count;
+    atomic_int next;        // Next file to hand out
+    pthread_mutex_t lock;   // Protects the totals below
+    int failed;
+    double pixels;
+} t_batch;
+
+// Add a copy of path to a growing list. Returns 0 on success.
+static int cli_addFile(t_batch *batch, int *capacity, const char *path) {
+    if (batch->count == *capacity) {
+        int grown = *capacity ? 2 * *capacity : 64;
+        char **files = realloc(batch->files, grown * sizeof(char *));
+        if (!files) return -1;
+        batch->files = files;
+        *capacity = grown;
+    }
+    batch->files[batch->count] = strdup(path);
+    if (!batch->files[batch->count]) return -1;
+    batch->count++;
+    return 0;
+}
+
+// Sort order of the file list
+static int cli_comparePaths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// List the .bmp files of a directory, or the paths listed in a text file. Returns 0 on success.
+static int cli_listFiles(const char *source, t_batch *batch) {
+    int capacity = 0;
+    char path[CLI_MAX_PATH];
+
+    DIR *dir = opendir(source);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            size_t length = strlen(entry->d_name);
+            if (length < 5 || strcasecmp(entry->d_name + length - 4, ".bmp") != 0) continue;
+            snprintf(path, sizeof(path), "%s/%s", source, entry->d_name);
+            if (cli_addFile(batch, &capacity, path) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+        // Same order from run to run, whatever the file system returns
+        if (batch->count > 1) qsort(batch->files, batch->count, sizeof(char *), cli_comparePaths);
+        return 0;
+    }
+
+    FILE *list = fopen(source, "r");
+    if (!list) return -1;
+    while (fgets(path, sizeof(path), list)) {
+        path[strcspn(path, "\r\n")] = '\0';
+        if (path[0] == '\0') continue;
+        if (cli_addFile(batch, &capacity, path) != 0) {
+            fclose(list);
+            return -1;
+        }
+    }
+    fclose(list);
+    return 0;
+}
+
+// Batch worker: take the next file until none are left. While one worker waits
+// on the disk, the others keep computing.
+static void *cli_batchWorker(void *context) {
+    t_batch *batch = context;
+    const t_pipeline *pipeline = batch->pipeline;
+    char output[CLI_MAX_PATH];
+    trace_nameThread("batch worker");
+
+    for (;;) {
+        int i = atomic_fetch_add(&batch->next, 1);
+        if (i >= batch->count) break;
+
+        const char *name = strrchr(batch->files[i], '/');
+        name = name ? name + 1 : batch->files[i];
+        snprintf(output, sizeof(output), "%s/%s", pipeline->output, name);
+
+        double pixels = 0;
+        int status = cli_processImage(pipeline, batch->files[i], output, &pixels);
+
+        pthread_mutex_lock(&batch->lock);
+        if (status != 0) batch->failed++;
+        batch->pixels += pixels;
+        pthread_mutex_unlock(&batch->lock);
+    }
+    bmp_releaseScratch();
+    return NULL;
+}
+
+// Seconds elapsed on a monotonic clock
+static double cli_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Process every image of a batch on several workers and report the throughput
+static int cli_runBatch(const t_pipeline *pipeline) {
+    t_batch batch = { .pipeline = pipeline };
+    if (cli_listFiles(pipeline->input, &batch) != 0) {
+        fprintf(stderr, "ImgFun: couldn't list the images of %s\n", pipeline->input);
+        for (int i = 0; i < batch.count; i++) free(batch.files[i]);
+        free(batch.files);
+        return CLI_EXIT_LOAD;
+    }
+
+    int jobs = pipeline->jobs;
+    if (jobs <= 0) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs > batch.count) jobs = batch.count;
+    if (jobs < 1) jobs = 1;
+    // Images already keep every core busy: each one runs on its own worker
+    if (jobs > 1 && pipeline->threads < 0) pool_setThreadCount(1);
+
+    atomic_init(&batch.next, 0);
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_t *workers = malloc(jobs * sizeof(pthread_t));
+    double start = cli_now();
+
+    // The calling thread is the first worker
+    int started = 0;
+    for (int i = 1; workers && i < jobs; i++) {
+        if (pthread_create(&workers[started], NULL, cli_batchWorker, &batch) != 0) break;
+        started++;
+    }
+    cli_batchWorker(&batch);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+    double seconds = cli_now() - start;
+    pthread_mutex_destroy(&batch.lock);
+    free(workers);
+
+    int done = batch.count - batch.failed;
+    double rate = seconds > 0 ? 1.0 / seconds : 0;
+    printf("Processed %d images (%d failed) in %.2f s: %.1f images/s, %.1f MPix/s\n",
+           done, batch.failed, seconds, done * rate, batch.pixels / 1e6 * rate);
+
+    for (int i = 0; i < batch.count; i++) free(batch.files[i]);
+    free(batch.files);
+    return batch.failed ? CLI_EXIT_BATCH : 0;
+}
+
+// Send the library's messages to stderr, ahead of the line saying which image failed
+static void cli_log(t_imgfunError error, const char *message, void *context) {
+    (void)error;
+    (void)context;
+    fprintf(stderr, "ImgFun: %s\n", message);
+}
+
+// Run the command-line mode
+int cli_run(int argc, char **argv) {
+    imgfun_setLog(cli_log, NULL);
+    t_pipeline pipeline = {0};
+    pipeline.steps = malloc(argc * sizeof(t_step));
+    if (!pipeline.steps) return EXIT_FAILURE;
+
+    int status = cli_parse(argc, argv, &pipeline);
+    if (status == 0) {
+        if (pipeline.threads >= 0) pool_setThreadCount(pipeline.threads);
+        if (pipeline.batch) {
+            status = cli_runBatch(&pipeline);
+        } else {
+            double pixels = 0;
+            status = cli_processImage(&pipeline, pipeline.input, pipeline.output, &pixels);
+        }
+    } else if (status < 0) {
+        status = 0;
+    }
+
+    bmp_releaseScratch();
+    free(pipeline.steps);
+    return status;
+}
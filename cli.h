@@ -0,0 +1,16 @@
+#ifndef CLI_H
+#define CLI_H
+
+// Exit statuses of the command-line mode (0 on success)
+#define CLI_EXIT_USAGE 2        // Wrong arguments
+#define CLI_EXIT_LOAD 3         // The input image couldn't be read
+#define CLI_EXIT_UNSUPPORTED 4  // An operation doesn't exist for the image's color depth
+#define CLI_EXIT_SAVE 5         // The output image couldn't be written
+#define CLI_EXIT_BATCH 6        // Some images of a batch failed
+#define CLI_EXIT_OPERATION 7    // An operation failed (out of memory): nothing was written
+
+// Function to run the command-line mode: one image, or a batch of them with --batch.
+// Returns the exit status of the process.
+int cli_run(int argc, char **argv);
+
+#endif // CLI_H
@@ -0,0 +1,922 @@
+#include "convolution.h"
+#include "threadpool.h"
+#include "cpu.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+// Largest kernel the separable detection handles without allocating
+#define CONV_MAX_STACK_KERNEL 64
+
+// Below this sigma conv_gaussianBlur uses an exact kernel instead of stacked boxes
+#define CONV_GAUSSIAN_BOX_SIGMA 3.0f
+// Largest radius of that kernel: 3 sigma
+#define CONV_GAUSSIAN_KERNEL_RADIUS 9
+
+// Most interleaved samples per pixel a raster may have
+#define CONV_MAX_CHANNELS 4
+
+// Bytes of output rows an in-place convolution holds before writing them back
+#define CONV_IN_PLACE_BYTES (1 << 20)
+
+// Minimum number of samples in a band of rows handed to one thread
+#define CONV_BAND_SAMPLES 65536
+
+// Division of an integer sum by the kernel divisor, prepared once per call
+typedef struct {
+    int divisor;      // Normalization divisor
+    int bias;         // Added before dividing: divisor / 2 to round, 0 to truncate
+    int narrow;       // Non-zero when sums fit in 16 bits and the vector path can be used
+    uint16_t magic;   // For narrow sums, x / divisor == mulhi(x, magic) >> shift
+    int shift;
+} t_intDivide;
+
+// One non-zero tap of an integer kernel for the output row being computed
+typedef struct {
+    const uint8_t *src;  // Source sample for output sample 0 of the row
+    int16_t weight;
+} t_intTap;
+
+// Vector kernels built for one instruction set (see convolution_vector.h)
+typedef struct {
+    int width;  // Samples produced per iteration: rows need at least this many interior samples
+    void (*vector2D3)(const uint8_t *const *rows, float *const *coeffs, int count, int channels,
+                      int begin, int end, uint8_t *out, t_convRounding rounding);
+    void (*vector2D5)(const uint8_t *const *rows, float *const *coeffs, int count, int channels,
+                      int begin, int end, uint8_t *out, t_convRounding rounding);
+    void (*vector2DN)(const uint8_t *const *rows, float *const *coeffs, int count, int kernelSize,
+                      int channels, int begin, int end, uint8_t *out, t_convRounding rounding);
+    int (*vectorColumn)(const uint8_t *const *rows, const float *column, int count, int length,
+                        float *tmp);
+    void (*vectorRow)(const float *tmp, const float *row, int kernelSize, int channels, int begin,
+                      int end, uint8_t *out, t_convRounding rounding);
+    void (*vectorInt)(const t_intTap *taps, int count, int begin, int end, uint8_t *out,
+                      const t_intDivide *div);
+} t_convKernels;
+
+// Parameters shared by the row bands of one convolution
+typedef struct {
+    const t_raster *src;
+    const t_raster *dst;
+    float **kernel;                 // Float 2D kernel
+    const float *row;               // Separable horizontal kernel
+    const float *column;            // Separable vertical kernel
+    const t_intKernel *intKernel;   // Integer kernel
+    t_intDivide div;                // Normalization of the integer kernel
+    int kernelSize;
+    int radius;                     // Box blur radius
+    t_convRounding rounding;
+    t_convEdge edge;
+    int first;                      // First output row of the call
+    t_poolTask rows;                // Computes a range of output rows
+    int outFirst;                   // Output row held in dst row 0
+    const uint8_t *saved;           // In place: original rows [first - n, first), row r at r % n
+    const uint8_t *top;             // In place, wrapping: original rows [0, n)
+    const t_convKernels *isa;       // Vector kernels, NULL for the scalar code
+    atomic_int status;              // Set to -1 by a band that fails to allocate
+} t_convJob;
+
+// Defined after the vector kernels it picks from
+static const t_convKernels *conv_selectKernels(void);
+
+// Rows per parallel band: enough samples to amortize handing the band out
+static int conv_grain(const t_raster *raster) {
+    int rowLength = raster->width * raster->channels;
+    return rowLength >= CONV_BAND_SAMPLES ? 1 : CONV_BAND_SAMPLES / rowLength;
+}
+
+// Shift the bands of the pool, which count from 0, to the rows of the call
+static void conv_offsetRows(void *context, int y0, int y1) {
+    t_convJob *job = context;
+    job->rows(job, y0 + job->first, y1 + job->first);
+}
+
+// Compute the output rows [y0, y1) of a prepared job in parallel bands
+static int conv_run(t_convJob *job, t_poolTask rows, int y0, int y1) {
+    job->rows = rows;
+    job->first = y0;
+    job->isa = conv_selectKernels();
+    atomic_init(&job->status, 0);
+    if (y1 > y0) pool_parallelFor(y1 - y0, conv_grain(job->src), conv_offsetRows, job);
+    return atomic_load(&job->status);
+}
+
+// Clamp a filtered value to [0, 255] and store it into 8 bits
+static inline uint8_t conv_store(float value, t_convRounding rounding) {
+    if (value < 0) value = 0;
+    if (value > 255) value = 255;
+    return rounding == CONV_ROUND ? (uint8_t)roundf(value) : (uint8_t)value;
+}
+
+// Border pass of a 2D row: pixels [x0, x1), whose taps may fall outside the row.
+// rows/coeffs list the source rows of the kernel and their kernel rows, top to bottom.
+static void conv_border2D(const uint8_t *const *rows, float *const *coeffs, int count,
+                          int kernelSize, int width, int channels, int x0, int x1,
+                          uint8_t *out, t_convRounding rounding, t_convEdge edge) {
+    int n = kernelSize / 2;
+    for (int x = x0; x < x1; x++) {
+        for (int c = 0; c < channels; c++) {
+            float sum = 0.0f;
+            for (int r = 0; r < count; r++) {
+                for (int kx = -n; kx <= n; kx++) {
+                    int ix = conv_edgeIndex(x + kx, width, edge);
+                    if (ix < 0) continue;
+                    sum += rows[r][ix * channels + c] * coeffs[r][kx + n];
+                }
+            }
+            out[x * channels + c] = conv_store(sum, rounding);
+        }
+    }
+}
+
+// Scalar interior of a 2D row: samples [begin, end), every tap inside the row
+static void conv_pixels2D(const uint8_t *const *rows, float *const *coeffs, int count,
+                          int kernelSize, int channels, int begin, int end, uint8_t *out,
+                          t_convRounding rounding) {
+    int n = kernelSize / 2;
+    for (int i = begin; i < end; i++) {
+        float sum = 0.0f;
+        for (int r = 0; r < count; r++) {
+            const uint8_t *p = rows[r] + i - n * channels;
+            for (int kx = 0; kx < kernelSize; kx++) sum += p[kx * channels] * coeffs[r][kx];
+        }
+        out[i] = conv_store(sum, rounding);
+    }
+}
+
+// Border pass of the horizontal separable pass: pixels [x0, x1)
+static void conv_borderRow(const float *tmp, const float *row, int kernelSize, int width,
+                           int channels, int x0, int x1, uint8_t *out, t_convRounding rounding,
+                           t_convEdge edge) {
+    int n = kernelSize / 2;
+    for (int x = x0; x < x1; x++) {
+        for (int c = 0; c < channels; c++) {
+            float sum = 0.0f;
+            for (int kx = -n; kx <= n; kx++) {
+                int ix = conv_edgeIndex(x + kx, width, edge);
+                if (ix < 0) continue;
+                sum += tmp[ix * channels + c] * row[kx + n];
+            }
+            out[x * channels + c] = conv_store(sum, rounding);
+        }
+    }
+}
+
+// Scalar interior of the horizontal separable pass: samples [begin, end)
+static void conv_pixelsRow(const float *tmp, const float *row, int kernelSize, int channels,
+                           int begin, int end, uint8_t *out, t_convRounding rounding) {
+    int n = kernelSize / 2;
+    for (int i = begin; i < end; i++) {
+        const float *p = tmp + i - n * channels;
+        float sum = 0.0f;
+        for (int kx = 0; kx < kernelSize; kx++) sum += p[kx * channels] * row[kx];
+        out[i] = conv_store(sum, rounding);
+    }
+}
+
+// Split a row of width pixels into border [0, left), interior [left, right) and
+// border [right, width) for a kernel of kernelSize taps
+static void conv_splitRow(int width, int kernelSize, int *left, int *right) {
+    int n = kernelSize / 2;
+    *left = n < width ? n : width;
+    *right = width - n > *left ? width - n : *left;
+}
+
+// The vector kernels, once per instruction set cpu_level() may pick
+#if CPU_X86
+#define CONV_SSE42
+#include "convolution_vector.h"
+#define CONV_AVX2
+#include "convolution_vector.h"
+#define CONV_AVX512
+#include "convolution_vector.h"
+#endif
+
+// Vector kernels of the instruction set cpu_level() picks, NULL for the scalar code
+static const t_convKernels *conv_selectKernels(void) {
+#if CPU_X86
+    switch (cpu_level()) {
+        case CPU_AVX512:
+            return &conv_kernels_avx512;
+        case CPU_AVX2:
+            return &conv_kernels_avx2;
+        case CPU_SSE42:
+            return &conv_kernels_sse42;
+        default:
+            break;
+    }
+#endif
+    return NULL;
+}
+
+// Interior samples [begin, end) of a 2D row, vectorized when long enough
+static void conv_interior2D(const t_convKernels *isa, const uint8_t *const *rows,
+                            float *const *coeffs, int count, int kernelSize, int channels,
+                            int begin, int end, uint8_t *out, t_convRounding rounding) {
+    if (isa && end - begin >= isa->width) {
+        if (kernelSize == 3) isa->vector2D3(rows, coeffs, count, channels, begin, end, out, rounding);
+        else if (kernelSize == 5) isa->vector2D5(rows, coeffs, count, channels, begin, end, out, rounding);
+        else isa->vector2DN(rows, coeffs, count, kernelSize, channels, begin, end, out, rounding);
+        return;
+    }
+    conv_pixels2D(rows, coeffs, count, kernelSize, channels, begin, end, out, rounding);
+}
+
+// Original content of source row r. In place, the rows before the first output
+// row of the call were overwritten and are read from the copies kept aside.
+static const uint8_t *conv_sourceRow(const t_convJob *job, int r) {
+    const t_raster *src = job->src;
+    int n = job->kernelSize / 2;
+    if (!job->saved || r >= job->first) return src->data + (size_t)r * src->stride;
+    if (r >= job->first - n) return job->saved + (size_t)(r % n) * src->stride;
+    return job->top + (size_t)r * src->stride;
+}
+
+// Output row y in dst
+static uint8_t *conv_outRow(const t_convJob *job, int y) {
+    return job->dst->data + (size_t)(y - job->outFirst) * job->dst->stride;
+}
+
+// Source rows covered by a kernel centered on row y, with their kernel rows.
+// Rows mapped outside the image by the edge mode are left out. Returns the count.
+static int conv_kernelRows(const t_convJob *job, int y, const uint8_t **rows, int *kernelRows) {
+    int n = job->kernelSize / 2;
+    int count = 0;
+    for (int ky = -n; ky <= n; ky++) {
+        int iy = conv_edgeIndex(y + ky, job->src->height, job->edge);
+        if (iy < 0) continue;
+        rows[count] = conv_sourceRow(job, iy);
+        kernelRows[count] = ky + n;
+        count++;
+    }
+    return count;
+}
+
+// Float 2D convolution of the output rows [y0, y1)
+static void conv_rows2D(void *context, int y0, int y1) {
+    t_convJob *job = context;
+    const t_raster *src = job->src;
+    int kernelSize = job->kernelSize;
+    int channels = src->channels;
+    t_convRounding rounding = job->rounding;
+
+    const uint8_t *stackRows[CONV_MAX_STACK_KERNEL];
+    float *stackCoeffs[CONV_MAX_STACK_KERNEL];
+    int stackIndex[CONV_MAX_STACK_KERNEL];
+    const uint8_t **rows = stackRows;
+    float **coeffs = stackCoeffs;
+    int *kernelRows = stackIndex;
+    if (kernelSize > CONV_MAX_STACK_KERNEL) {
+        rows = malloc(kernelSize * sizeof(*rows));
+        coeffs = malloc(kernelSize * sizeof(*coeffs));
+        kernelRows = malloc(kernelSize * sizeof(int));
+        if (!rows || !coeffs || !kernelRows) {
+            free(rows);
+            free(coeffs);
+            free(kernelRows);
+            atomic_store(&job->status, -1);
+            return;
+        }
+    }
+
+    int left, right;
+    conv_splitRow(src->width, kernelSize, &left, &right);
+    for (int y = y0; y < y1; y++) {
+        int count = conv_kernelRows(job, y, rows, kernelRows);
+        for (int r = 0; r < count; r++) coeffs[r] = job->kernel[kernelRows[r]];
+
+        uint8_t *out = conv_outRow(job, y);
+        conv_interior2D(job->isa, rows, coeffs, count, kernelSize, channels, left * channels,
+                        right * channels, out, rounding);
+        conv_border2D(rows, coeffs, count, kernelSize, src->width, channels, 0, left, out,
+                      rounding, job->edge);
+        conv_border2D(rows, coeffs, count, kernelSize, src->width, channels, right, src->width,
+                      out, rounding, job->edge);
+    }
+
+    if (rows != stackRows) {
+        free(rows);
+        free(coeffs);
+        free(kernelRows);
+    }
+}
+
+// Float 2D convolution of the output rows [y0, y1)
+static int conv_range2D(const t_raster *src, const t_raster *dst, float **kernel, int kernelSize,
+                        t_convRounding rounding, t_convEdge edge, int y0, int y1) {
+    t_convJob job = { .src = src, .dst = dst, .kernel = kernel, .kernelSize = kernelSize,
+                      .rounding = rounding, .edge = edge };
+    return conv_run(&job, conv_rows2D, y0, y1);
+}
+
+// Apply a square convolution kernel from src into dst
+int conv_apply2D(const t_raster *src, const t_raster *dst, float **kernel, int kernelSize,
+                 t_convRounding rounding, t_convEdge edge) {
+    return conv_range2D(src, dst, kernel, kernelSize, rounding, edge, 0, src->height);
+}
+
+// Split a kernel into column[i] * row[j] if it has rank 1
+int conv_isSeparable(float **kernel, int kernelSize, float *column, float *row) {
+    // The largest coefficient is the pivot: its row becomes the horizontal
+    // kernel and its column, scaled to 1 at the pivot, the vertical one.
+    // Kernels like 1/9 then split into {1,1,1} x {1/9,1/9,1/9} exactly.
+    int p = 0, q = 0;
+    float largest = 0.0f;
+    for (int i = 0; i < kernelSize; i++) {
+        for (int j = 0; j < kernelSize; j++) {
+            if (fabsf(kernel[i][j]) > largest) {
+                largest = fabsf(kernel[i][j]);
+                p = i;
+                q = j;
+            }
+        }
+    }
+    if (largest == 0.0f) return 0;
+
+    for (int j = 0; j < kernelSize; j++) row[j] = kernel[p][j];
+    for (int i = 0; i < kernelSize; i++) column[i] = kernel[i][q] / kernel[p][q];
+
+    float tolerance = largest * 1e-6f;
+    for (int i = 0; i < kernelSize; i++) {
+        for (int j = 0; j < kernelSize; j++) {
+            if (fabsf(kernel[i][j] - column[i] * row[j]) > tolerance) return 0;
+        }
+    }
+    return 1;
+}
+
+// Interior samples [begin, end) of the horizontal separable pass
+static void conv_interiorRow(const t_convKernels *isa, const float *tmp, const float *row,
+                             int kernelSize, int channels, int begin, int end, uint8_t *out,
+                             t_convRounding rounding) {
+    if (isa && end - begin >= isa->width) {
+        isa->vectorRow(tmp, row, kernelSize, channels, begin, end, out, rounding);
+        return;
+    }
+    conv_pixelsRow(tmp, row, kernelSize, channels, begin, end, out, rounding);
+}
+
+// Separable convolution of the output rows [y0, y1)
+static void conv_rowsSeparable(void *context, int y0, int y1) {
+    t_convJob *job = context;
+    const t_raster *src = job->src;
+    int kernelSize = job->kernelSize;
+    int channels = src->channels;
+    int rowLength = src->width * channels;
+    t_convRounding rounding = job->rounding;
+
+    // One row of vertically filtered values, kept in float between the passes,
+    // plus the source rows and coefficients of the vertical pass
+    float *tmp = malloc(rowLength * sizeof(float));
+    const uint8_t **rows = malloc(kernelSize * sizeof(*rows));
+    float *coeffs = malloc(kernelSize * sizeof(float));
+    int *kernelRows = malloc(kernelSize * sizeof(int));
+    if (!tmp || !rows || !coeffs || !kernelRows) {
+        free(tmp);
+        free(rows);
+        free(coeffs);
+        free(kernelRows);
+        atomic_store(&job->status, -1);
+        return;
+    }
+
+    int left, right;
+    conv_splitRow(src->width, kernelSize, &left, &right);
+    for (int y = y0; y < y1; y++) {
+        int count = conv_kernelRows(job, y, rows, kernelRows);
+        for (int r = 0; r < count; r++) coeffs[r] = job->column[kernelRows[r]];
+
+        int done = job->isa ? job->isa->vectorColumn(rows, coeffs, count, rowLength, tmp) : 0;
+        for (int i = done; i < rowLength; i++) {
+            float sum = 0.0f;
+            for (int r = 0; r < count; r++) sum += rows[r][i] * coeffs[r];
+            tmp[i] = sum;
+        }
+
+        uint8_t *out = conv_outRow(job, y);
+        const float *row = job->row;
+        conv_interiorRow(job->isa, tmp, row, kernelSize, channels, left * channels,
+                         right * channels, out, rounding);
+        conv_borderRow(tmp, row, kernelSize, src->width, channels, 0, left, out, rounding, job->edge);
+        conv_borderRow(tmp, row, kernelSize, src->width, channels, right, src->width, out,
+                       rounding, job->edge);
+    }
+
+    free(tmp);
+    free(rows);
+    free(coeffs);
+    free(kernelRows);
+}
+
+// Separable convolution of the output rows [y0, y1)
+static int conv_rangeSeparable(const t_raster *src, const t_raster *dst, const float *row,
+                               const float *column, int kernelSize, t_convRounding rounding,
+                               t_convEdge edge, int y0, int y1) {
+    t_convJob job = { .src = src, .dst = dst, .row = row, .column = column,
+                      .kernelSize = kernelSize, .rounding = rounding, .edge = edge };
+    return conv_run(&job, conv_rowsSeparable, y0, y1);
+}
+
+// Apply a separable kernel (vertical 1D kernel, then horizontal 1D kernel)
+int conv_applySeparable(const t_raster *src, const t_raster *dst, const float *row,
+                        const float *column, int kernelSize, t_convRounding rounding,
+                        t_convEdge edge) {
+    return conv_rangeSeparable(src, dst, row, column, kernelSize, rounding, edge, 0, src->height);
+}
+
+// Find magic and shift so that mulhi(x, magic) >> shift == x / divisor for all x <= limit
+static int conv_findMagic(int divisor, int limit, uint16_t *magic, int *shift) {
+    for (int s = 0; s < 16; s++) {
+        uint32_t m = ((1u << (16 + s)) + divisor - 1) / divisor;
+        if (m > 0xFFFF) break;
+        int exact = 1;
+        for (uint32_t x = 0; x <= (uint32_t)limit && exact; x++) {
+            if (((x * m) >> (16 + s)) != x / (uint32_t)divisor) exact = 0;
+        }
+        if (exact) {
+            *magic = (uint16_t)m;
+            *shift = s;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Prepare the normalization of an integer kernel
+static void conv_prepareDivide(const t_intKernel *kernel, t_convRounding rounding, t_intDivide *div) {
+    div->divisor = kernel->divisor;
+    div->bias = rounding == CONV_ROUND ? kernel->divisor / 2 : 0;
+    div->magic = 0;
+    div->shift = 0;
+
+    // Every partial sum lies within +-255 * sum(|w|), whatever the tap order
+    long magnitude = 0;
+    for (int i = 0; i < kernel->size * kernel->size; i++) magnitude += labs(kernel->weights[i]);
+    div->narrow = magnitude * 255 <= INT16_MAX;
+    if (div->narrow && div->divisor > 1) {
+        div->narrow = conv_findMagic(div->divisor, (int)(magnitude * 255) + div->bias,
+                                     &div->magic, &div->shift);
+    }
+}
+
+// Clamp, normalize and store an integer sum into 8 bits
+static inline uint8_t conv_storeInt(long sum, const t_intDivide *div) {
+    if (sum < 0) sum = 0;
+    long value = (sum + div->bias) / div->divisor;
+    return value > 255 ? 255 : (uint8_t)value;
+}
+
+// Border pass of an integer row: pixels [x0, x1), accumulated in 32 bits
+static void conv_borderInt(const uint8_t *const *rows, const int *const *weights, int count,
+                           int kernelSize, int width, int channels, int x0, int x1,
+                           uint8_t *out, const t_intDivide *div, t_convEdge edge) {
+    int n = kernelSize / 2;
+    for (int x = x0; x < x1; x++) {
+        for (int c = 0; c < channels; c++) {
+            long sum = 0;
+            for (int r = 0; r < count; r++) {
+                for (int kx = -n; kx <= n; kx++) {
+                    int ix = conv_edgeIndex(x + kx, width, edge);
+                    if (ix < 0) continue;
+                    sum += rows[r][ix * channels + c] * weights[r][kx + n];
+                }
+            }
+            out[x * channels + c] = conv_storeInt(sum, div);
+        }
+    }
+}
+
+// Scalar interior of an integer row: samples [begin, end), accumulated in 32 bits
+static void conv_pixelsInt(const t_intTap *taps, int count, int begin, int end, uint8_t *out,
+                           const t_intDivide *div) {
+    for (int i = begin; i < end; i++) {
+        long sum = 0;
+        for (int t = 0; t < count; t++) sum += taps[t].src[i] * taps[t].weight;
+        out[i] = conv_storeInt(sum, div);
+    }
+}
+
+// Convert a float kernel to integer weights over a divisor of at most 256
+int conv_quantize(float **kernel, int kernelSize, t_intKernel *out) {
+    if (kernelSize < 1 || kernelSize > CONV_MAX_INT_KERNEL) return 0;
+
+    for (int divisor = 1; divisor <= 256; divisor++) {
+        int exact = 1;
+        for (int i = 0; i < kernelSize && exact; i++) {
+            for (int j = 0; j < kernelSize && exact; j++) {
+                // Only kernels that already are weight / divisor (within one ULP, for
+                // 1 / 9.f and the like): anything looser would change the results
+                float weight = roundf(kernel[i][j] * divisor);
+                float value = weight / divisor;
+                if (fabsf(weight) > INT16_MAX
+                    || (value != kernel[i][j] && nextafterf(value, kernel[i][j]) != kernel[i][j])) {
+                    exact = 0;
+                } else {
+                    out->weights[i * kernelSize + j] = (int)weight;
+                }
+            }
+        }
+        if (exact) {
+            out->size = kernelSize;
+            out->divisor = divisor;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Interior samples [begin, end) of an integer row, vectorized when sums fit in 16 bits
+static void conv_interiorInt(const t_convKernels *isa, const t_intTap *taps, int count, int begin,
+                             int end, uint8_t *out, const t_intDivide *div) {
+    if (isa && div->narrow && end - begin >= isa->width) {
+        isa->vectorInt(taps, count, begin, end, out, div);
+        return;
+    }
+    conv_pixelsInt(taps, count, begin, end, out, div);
+}
+
+// Integer convolution of the output rows [y0, y1)
+static void conv_rowsInt(void *context, int y0, int y1) {
+    t_convJob *job = context;
+    const t_raster *src = job->src;
+    const t_intKernel *kernel = job->intKernel;
+    const t_intDivide *div = &job->div;
+    int size = kernel->size;
+    int n = size / 2;
+    int channels = src->channels;
+
+    const uint8_t *rows[CONV_MAX_INT_KERNEL];
+    const int *weights[CONV_MAX_INT_KERNEL];
+    int kernelRows[CONV_MAX_INT_KERNEL];
+    t_intTap taps[CONV_MAX_INT_KERNEL * CONV_MAX_INT_KERNEL];
+
+    int left, right;
+    conv_splitRow(src->width, size, &left, &right);
+    for (int y = y0; y < y1; y++) {
+        int count = conv_kernelRows(job, y, rows, kernelRows);
+
+        // Interior taps, with zero weights dropped
+        int tapCount = 0;
+        for (int r = 0; r < count; r++) {
+            weights[r] = kernel->weights + kernelRows[r] * size;
+            for (int kx = 0; kx < size; kx++) {
+                if (weights[r][kx] == 0) continue;
+                taps[tapCount].src = rows[r] + (kx - n) * channels;
+                taps[tapCount].weight = (int16_t)weights[r][kx];
+                tapCount++;
+            }
+        }
+
+        uint8_t *out = conv_outRow(job, y);
+        conv_interiorInt(job->isa, taps, tapCount, left * channels, right * channels, out, div);
+        conv_borderInt(rows, weights, count, size, src->width, channels, 0, left, out, div,
+                       job->edge);
+        conv_borderInt(rows, weights, count, size, src->width, channels, right, src->width, out,
+                       div, job->edge);
+    }
+}
+
+// Integer convolution of the output rows [y0, y1)
+static int conv_rangeInt(const t_raster *src, const t_raster *dst, const t_intKernel *kernel,
+                         t_convRounding rounding, t_convEdge edge, int y0, int y1) {
+    int size = kernel->size;
+    if (size < 1 || size > CONV_MAX_INT_KERNEL || kernel->divisor < 1) return -1;
+
+    t_convJob job = { .src = src, .dst = dst, .intKernel = kernel, .kernelSize = size,
+                      .rounding = rounding, .edge = edge };
+    conv_prepareDivide(kernel, rounding, &job.div);
+    return conv_run(&job, conv_rowsInt, y0, y1);
+}
+
+// Apply an integer kernel from src into dst
+int conv_applyInt(const t_raster *src, const t_raster *dst, const t_intKernel *kernel,
+                  t_convRounding rounding, t_convEdge edge) {
+    return conv_rangeInt(src, dst, kernel, rounding, edge, 0, src->height);
+}
+
+// Row of src read for virtual row iy under the edge mode, NULL for a zero row
+static const uint8_t *conv_boxRow(const t_raster *src, int iy, t_convEdge edge) {
+    iy = conv_edgeIndex(iy, src->height, edge);
+    return iy < 0 ? NULL : src->data + (size_t)iy * src->stride;
+}
+
+// Column sums of virtual column x, following the edge mode, copied to to
+static inline void conv_boxPad(uint32_t *to, const uint32_t *columns, int x, int width,
+                               int channels, t_convEdge edge) {
+    int ix = conv_edgeIndex(x, width, edge);
+    for (int c = 0; c < channels; c++) to[c] = ix < 0 ? 0 : columns[ix * channels + c];
+}
+
+// In-place running sums of each channel of an interleaved row. Inlined so the
+// running totals of a constant channel count stay in registers.
+static inline __attribute__((always_inline))
+void conv_prefixSums(uint32_t *values, int length, int channels) {
+    uint32_t running[CONV_MAX_CHANNELS] = {0};
+    for (int i = 0; i < length; i += channels) {
+        for (int c = 0; c < channels; c++) {
+            running[c] += values[i + c];
+            values[i + c] = running[c];
+        }
+    }
+}
+
+// Box blur of the output rows [y0, y1): running column sums over 2r + 1 rows,
+// then sums over 2r + 1 columns of those taken from prefix sums
+static void conv_rowsBox(void *context, int y0, int y1) {
+    t_convJob *job = context;
+    const t_raster *src = job->src;
+    t_convEdge edge = job->edge;
+    int r = job->radius;
+    int channels = src->channels;
+    int width = src->width;
+    int length = width * channels;
+    int paddedLength = (width + 2 * r) * channels;
+
+    // Column sums of the current output row, and a row of prefix sums over those
+    // sums padded with r pixels on each side, after one leading pixel of zeros
+    uint32_t *columns = calloc(length, sizeof(uint32_t));
+    uint32_t *padded = calloc((size_t)paddedLength + channels, sizeof(uint32_t));
+    if (!columns || !padded) {
+        free(columns);
+        free(padded);
+        atomic_store(&job->status, -1);
+        return;
+    }
+    uint32_t *prefix = padded + channels;
+
+    // Exact division of sums below 256 * area by area: n / area == (n * magic) >> shift
+    // as long as 256 * area^2 <= 2^shift, and magic fits 32 bits for area < 2^24
+    uint64_t area = (uint64_t)(2 * r + 1) * (uint64_t)(2 * r + 1);
+    int shift = 0;
+    while ((1ull << shift) < 256 * area * area) shift++;
+    uint64_t magic = ((1ull << shift) + area - 1) / area;
+    uint32_t bias = job->rounding == CONV_ROUND ? (uint32_t)(area / 2) : 0;
+
+    for (int ky = -r; ky <= r; ky++) {
+        const uint8_t *in = conv_boxRow(src, y0 + ky, edge);
+        if (in) for (int i = 0; i < length; i++) columns[i] += in[i];
+    }
+
+    for (int y = y0; y < y1; y++) {
+        if (y > y0) {
+            // Slide the column sums down one row. Differences may wrap around
+            // 32 bits, which leaves the sums exact.
+            const uint8_t *in = conv_boxRow(src, y + r, edge);
+            const uint8_t *out = conv_boxRow(src, y - r - 1, edge);
+            if (in && out) {
+                for (int i = 0; i < length; i++) columns[i] += (uint32_t)in[i] - out[i];
+            } else if (in) {
+                for (int i = 0; i < length; i++) columns[i] += in[i];
+            } else if (out) {
+                for (int i = 0; i < length; i++) columns[i] -= out[i];
+            }
+        }
+
+        memcpy(prefix + (size_t)r * channels, columns, length * sizeof(uint32_t));
+        for (int k = 1; k <= r; k++) {
+            conv_boxPad(prefix + (size_t)(r - k) * channels, columns, -k, width, channels, edge);
+            conv_boxPad(prefix + (size_t)(r + width - 1 + k) * channels, columns, width - 1 + k,
+                        width, channels, edge);
+        }
+        // Prefix sums modulo 2^32: differences below 2^32 come out exact
+        if (channels == 1) conv_prefixSums(prefix, paddedLength, 1);
+        else if (channels == 3) conv_prefixSums(prefix, paddedLength, 3);
+        else conv_prefixSums(prefix, paddedLength, channels);
+
+        const uint32_t *high = prefix + (size_t)2 * r * channels;
+        const uint32_t *low = prefix - channels;
+        uint8_t *out = conv_outRow(job, y);
+        for (int i = 0; i < length; i++) {
+            uint32_t sum = high[i] - low[i] + bias;
+            out[i] = (uint8_t)(((uint64_t)sum * magic) >> shift);
+        }
+    }
+
+    free(columns);
+    free(padded);
+}
+
+// Apply a (2 * radius + 1)^2 box blur from src into dst with running sums
+int conv_boxBlur(const t_raster *src, const t_raster *dst, int radius, t_convRounding rounding,
+                 t_convEdge edge) {
+    if (radius < 0 || radius > CONV_MAX_BOX_RADIUS) return -1;
+
+    t_convJob job = { .src = src, .dst = dst, .radius = radius, .rounding = rounding,
+                      .edge = edge };
+    atomic_init(&job.status, 0);
+    // Each band starts by summing 2r + 1 rows: keep bands at least that tall
+    int grain = conv_grain(src);
+    if (grain < 2 * radius + 1) grain = 2 * radius + 1;
+    pool_parallelFor(src->height, grain, conv_rowsBox, &job);
+    return atomic_load(&job.status);
+}
+
+// Radii of the three boxes whose stack has the variance closest to sigma^2:
+// the widths are the odd numbers around sqrt(4 sigma^2 + 1), in the proportion
+// that best matches sigma (Kovesi, "Fast almost-Gaussian filtering", 2010)
+static void conv_gaussianBoxes(float sigma, int radii[3]) {
+    double variance = (double)sigma * sigma;
+    int lower = (int)floor(sqrt(4.0 * variance + 1.0));
+    if (lower % 2 == 0) lower--;
+    int count = (int)lround((12.0 * variance - 3.0 * lower * lower - 12.0 * lower - 9.0)
+                            / (-4.0 * lower - 4.0));
+    if (count < 0) count = 0;
+    if (count > 3) count = 3;
+    for (int i = 0; i < 3; i++) radii[i] = (i < count ? lower : lower + 2) / 2;
+}
+
+// Exact Gaussian blur for small sigma, with a separable kernel of radius 3 sigma
+static int conv_gaussianKernel(const t_raster *src, const t_raster *dst, float sigma,
+                               t_convRounding rounding, t_convEdge edge) {
+    int n = (int)ceilf(3.0f * sigma);
+    float kernel[2 * CONV_GAUSSIAN_KERNEL_RADIUS + 1];
+    float total = 0.0f;
+    for (int i = -n; i <= n; i++) {
+        kernel[i + n] = expf(-(float)(i * i) / (2.0f * sigma * sigma));
+        total += kernel[i + n];
+    }
+    for (int i = 0; i < 2 * n + 1; i++) kernel[i] /= total;
+    return conv_applySeparable(src, dst, kernel, kernel, 2 * n + 1, rounding, edge);
+}
+
+// Approximate a Gaussian blur with three stacked box blurs
+int conv_gaussianBlur(const t_raster *src, const t_raster *dst, float sigma,
+                      t_convRounding rounding, t_convEdge edge) {
+    if (!(sigma > 0.0f) || sigma > CONV_MAX_SIGMA) return -1;
+    if (sigma < CONV_GAUSSIAN_BOX_SIGMA) return conv_gaussianKernel(src, dst, sigma, rounding, edge);
+
+    int radii[3];
+    conv_gaussianBoxes(sigma, radii);
+
+    // Stacking boxes that each apply the edge mode only matches one Gaussian
+    // applying it when the mode commutes with symmetric blurs (mirror, wrap).
+    // Otherwise blur a copy padded by the total support and crop the result.
+    int pad = 0;
+    if (edge != CONV_EDGE_MIRROR && edge != CONV_EDGE_WRAP) pad = radii[0] + radii[1] + radii[2];
+
+    int channels = src->channels;
+    int width = src->width + 2 * pad, height = src->height + 2 * pad;
+    size_t stride = (size_t)width * channels;
+    t_raster a = { malloc(stride * height), width, height, channels, stride };
+    t_raster b = { pad ? malloc(stride * height) : NULL, width, height, channels, stride };
+    if (!a.data || (pad && !b.data)) {
+        free(a.data);
+        free(b.data);
+        return -1;
+    }
+
+    int status;
+    if (pad) {
+        for (int y = 0; y < height; y++) {
+            uint8_t *to = a.data + (size_t)y * stride;
+            int iy = conv_edgeIndex(y - pad, src->height, edge);
+            if (iy < 0) {
+                memset(to, 0, stride);
+                continue;
+            }
+            const uint8_t *from = src->data + (size_t)iy * src->stride;
+            memcpy(to + (size_t)pad * channels, from, (size_t)src->width * channels);
+            for (int k = 1; k <= pad; k++) {
+                int left = conv_edgeIndex(-k, src->width, edge);
+                int right = conv_edgeIndex(src->width - 1 + k, src->width, edge);
+                for (int c = 0; c < channels; c++) {
+                    to[(pad - k) * channels + c] = left < 0 ? 0 : from[left * channels + c];
+                    to[(pad + src->width - 1 + k) * channels + c] = right < 0 ? 0 : from[right * channels + c];
+                }
+            }
+        }
+        // Intermediate passes round to nearest so that only the last one truncates
+        status = conv_boxBlur(&a, &b, radii[0], CONV_ROUND, edge);
+        if (status == 0) status = conv_boxBlur(&b, &a, radii[1], CONV_ROUND, edge);
+        if (status == 0) status = conv_boxBlur(&a, &b, radii[2], rounding, edge);
+        if (status == 0) {
+            for (int y = 0; y < src->height; y++) {
+                memcpy(dst->data + (size_t)y * dst->stride,
+                       b.data + (size_t)(y + pad) * stride + (size_t)pad * channels,
+                       (size_t)src->width * channels);
+            }
+        }
+    } else {
+        status = conv_boxBlur(src, dst, radii[0], CONV_ROUND, edge);
+        if (status == 0) status = conv_boxBlur(dst, &a, radii[1], CONV_ROUND, edge);
+        if (status == 0) status = conv_boxBlur(&a, dst, radii[2], rounding, edge);
+    }
+
+    free(a.data);
+    free(b.data);
+    return status;
+}
+
+// Weights of the stock kernels
+const float conv_stockKernels[CONV_STOCK_COUNT][CONV_STOCK_SIZE * CONV_STOCK_SIZE] = {
+    [CONV_STOCK_BOX] = { 1/9.f, 1/9.f, 1/9.f, 1/9.f, 1/9.f, 1/9.f, 1/9.f, 1/9.f, 1/9.f },
+    [CONV_STOCK_GAUSSIAN] = { 1/16.f, 2/16.f, 1/16.f, 2/16.f, 4/16.f, 2/16.f, 1/16.f, 2/16.f, 1/16.f },
+    [CONV_STOCK_OUTLINE] = { -1, -1, -1, -1, 8, -1, -1, -1, -1 },
+    [CONV_STOCK_EMBOSS] = { -2, -1, 0, -1, 1, 1, 0, 1, 2 },
+    [CONV_STOCK_SHARPEN] = { 0, -1, 0, -1, 5, -1, 0, -1, 0 },
+};
+
+// Point rows at the rows of a stock kernel (the filters only read them)
+void conv_stockRows(t_convStock stock, float **rows) {
+    for (int r = 0; r < CONV_STOCK_SIZE; r++) {
+        rows[r] = (float *)conv_stockKernels[stock] + r * CONV_STOCK_SIZE;
+    }
+}
+
+// Apply a kernel through the integer, separable or float 2D path
+int conv_apply(const t_raster *src, const t_raster *dst, float **kernel, int kernelSize,
+               t_convRounding rounding, t_convEdge edge) {
+    return conv_applyRows(src, dst, kernel, kernelSize, rounding, edge, 0, src->height);
+}
+
+// Kernels conv_plan derives from a float kernel, kept for the duration of the call
+typedef struct {
+    t_intKernel intKernel;
+    float column[CONV_MAX_STACK_KERNEL];
+    float row[CONV_MAX_STACK_KERNEL];
+} t_convPlan;
+
+// Set job up for the integer, separable or float 2D path and return its row task
+static t_poolTask conv_plan(t_convJob *job, t_convPlan *plan, float **kernel) {
+    int size = job->kernelSize;
+    if (conv_quantize(kernel, size, &plan->intKernel)) {
+        job->intKernel = &plan->intKernel;
+        conv_prepareDivide(&plan->intKernel, job->rounding, &job->div);
+        return conv_rowsInt;
+    }
+    if (size > 1 && size <= CONV_MAX_STACK_KERNEL
+        && conv_isSeparable(kernel, size, plan->column, plan->row)) {
+        job->row = plan->row;
+        job->column = plan->column;
+        return conv_rowsSeparable;
+    }
+    job->kernel = kernel;
+    return conv_rows2D;
+}
+
+// Compute only the output rows [y0, y1) of conv_apply
+int conv_applyRows(const t_raster *src, const t_raster *dst, float **kernel, int kernelSize,
+                   t_convRounding rounding, t_convEdge edge, int y0, int y1) {
+    if (y0 < 0) y0 = 0;
+    if (y1 > src->height) y1 = src->height;
+
+    t_convJob job = { .src = src, .dst = dst, .kernelSize = kernelSize, .rounding = rounding,
+                      .edge = edge };
+    t_convPlan plan;
+    t_poolTask rows = conv_plan(&job, &plan, kernel);
+    return conv_run(&job, rows, y0, y1);
+}
+
+// Apply a kernel like conv_apply, writing the result back into image
+int conv_applyInPlace(const t_raster *image, float **kernel, int kernelSize,
+                      t_convRounding rounding, t_convEdge edge) {
+    if (image->width <= 0 || image->height <= 0) return 0;
+    int n = kernelSize / 2;
+    size_t rowLength = (size_t)image->width * image->channels;
+    size_t stride = image->stride;
+    int strip = stride >= CONV_IN_PLACE_BYTES ? 1 : (int)(CONV_IN_PLACE_BYTES / stride);
+    if (strip > image->height) strip = image->height;
+    int wrapRows = edge != CONV_EDGE_WRAP ? 0 : (n < image->height ? n : image->height);
+
+    uint8_t *out = malloc(strip * stride);
+    uint8_t *saved = n > 0 ? malloc(n * stride) : NULL;
+    uint8_t *top = wrapRows > 0 ? malloc(wrapRows * stride) : NULL;
+    if (!out || (n > 0 && !saved) || (wrapRows > 0 && !top)) {
+        free(out);
+        free(saved);
+        free(top);
+        return -1;
+    }
+    // Wrapping taps of the last rows read the first ones, long overwritten by then
+    if (top) memcpy(top, image->data, wrapRows * stride);
+
+    t_raster dst = { out, image->width, strip, image->channels, stride };
+    t_convJob job = { .src = image, .dst = &dst, .kernelSize = kernelSize, .rounding = rounding,
+                      .edge = edge, .saved = saved, .top = top };
+    t_convPlan plan;
+    t_poolTask rows = conv_plan(&job, &plan, kernel);
+
+    int status = 0;
+    for (int y0 = 0; y0 < image->height && status == 0; y0 += strip) {
+        int y1 = image->height - y0 < strip ? image->height : y0 + strip;
+        job.outFirst = y0;
+        status = conv_run(&job, rows, y0, y1);
+
+        // The next strip still needs the originals of the last n rows of this one
+        for (int r = y1 - n > y0 ? y1 - n : y0; r < y1; r++) {
+            memcpy(saved + (size_t)(r % n) * stride, image->data + (size_t)r * stride, rowLength);
+        }
+        for (int y = y0; y < y1; y++) {
+            memcpy(image->data + (size_t)y * stride, out + (size_t)(y - y0) * stride, rowLength);
+        }
+    }
+
+    free(out);
+    free(saved);
+    free(top);
+    return status;
+}
@@ -0,0 +1,404 @@
+// Vector kernels of the convolution engine, for one instruction set. Only convolution.c
+// includes this file, once per instruction set, with one of CONV_SSE42, CONV_AVX2 or
+// CONV_AVX512 defined; each inclusion defines the t_convKernels table conv_kernels_<isa>.
+//
+// The kernels compute every output sample with the same sequence of float multiplies
+// and adds as the scalar code (no FMA, same tap order), so every instruction set gives
+// bit-identical results. They only run on the interior of a row; the border pass
+// handles the pixels closer than kernelSize / 2 to an edge.
+
+#if defined(CONV_AVX512)
+#define CONV_SUFFIX avx512
+#define CONV_TARGET CPU_TARGET_AVX512
+#define CONV_VECTOR 64
+#elif defined(CONV_AVX2)
+#define CONV_SUFFIX avx2
+#define CONV_TARGET CPU_TARGET_AVX2
+#define CONV_VECTOR 32
+#else
+#define CONV_SUFFIX sse42
+#define CONV_TARGET CPU_TARGET_SSE42
+#define CONV_VECTOR 16
+#endif
+
+// Every name below gets the suffix of the instruction set
+#define CONV_PASTE(name, suffix) name##_##suffix
+#define CONV_EXPAND(name, suffix) CONV_PASTE(name, suffix)
+#define CONV_NAME(name) CONV_EXPAND(name, CONV_SUFFIX)
+#define t_convVec CONV_NAME(t_convVec)
+#define conv_loadBytes CONV_NAME(conv_loadBytes)
+#define conv_loadFloats CONV_NAME(conv_loadFloats)
+#define conv_storeFloats CONV_NAME(conv_storeFloats)
+#define conv_set1 CONV_NAME(conv_set1)
+#define conv_zero CONV_NAME(conv_zero)
+#define conv_add CONV_NAME(conv_add)
+#define conv_mul CONV_NAME(conv_mul)
+#define conv_toInt CONV_NAME(conv_toInt)
+#define conv_storeBytes CONV_NAME(conv_storeBytes)
+#define conv_vector2D CONV_NAME(conv_vector2D)
+#define conv_vector2D3 CONV_NAME(conv_vector2D3)
+#define conv_vector2D5 CONV_NAME(conv_vector2D5)
+#define conv_vector2DN CONV_NAME(conv_vector2DN)
+#define conv_vectorColumn CONV_NAME(conv_vectorColumn)
+#define conv_vectorRow CONV_NAME(conv_vectorRow)
+#define conv_divide16 CONV_NAME(conv_divide16)
+#define conv_vectorInt CONV_NAME(conv_vectorInt)
+#define conv_kernels CONV_NAME(conv_kernels)
+
+// Primitives always inlined into the kernels, which carry the target attribute
+#define CONV_INLINE static inline __attribute__((always_inline)) CONV_TARGET
+
+#if defined(CONV_AVX512)
+
+typedef __m512 t_convVec;
+
+// Load 64 bytes as four vectors of 16 floats
+CONV_INLINE void conv_loadBytes(const uint8_t *p, t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(p + 16 * j));
+        f[j] = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes));
+    }
+}
+
+// Load 64 consecutive floats as four vectors
+CONV_INLINE void conv_loadFloats(const float *p, t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) f[j] = _mm512_loadu_ps(p + 16 * j);
+}
+
+// Store four vectors as 64 consecutive floats
+CONV_INLINE void conv_storeFloats(float *p, const t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) _mm512_storeu_ps(p + 16 * j, f[j]);
+}
+
+CONV_INLINE t_convVec conv_set1(float v) { return _mm512_set1_ps(v); }
+CONV_INLINE t_convVec conv_zero(void) { return _mm512_setzero_ps(); }
+CONV_INLINE t_convVec conv_add(t_convVec a, t_convVec b) { return _mm512_add_ps(a, b); }
+CONV_INLINE t_convVec conv_mul(t_convVec a, t_convVec b) { return _mm512_mul_ps(a, b); }
+
+// Convert a float vector to integers with the scalar rounding rule
+CONV_INLINE __m512i conv_toInt(t_convVec v, t_convRounding rounding) {
+    v = _mm512_min_ps(_mm512_max_ps(v, _mm512_setzero_ps()), _mm512_set1_ps(255.0f));
+    __m512i t = _mm512_cvttps_epi32(v);
+    if (rounding == CONV_ROUND) {
+        // roundf on non-negative values: add one when the fraction is >= 0.5
+        __m512 frac = _mm512_sub_ps(v, _mm512_cvtepi32_ps(t));
+        __mmask16 up = _mm512_cmp_ps_mask(frac, _mm512_set1_ps(0.5f), _CMP_GE_OQ);
+        t = _mm512_mask_add_epi32(t, up, t, _mm512_set1_epi32(1));
+    }
+    return t;
+}
+
+// Narrow four float vectors to 64 bytes (the values are already in [0, 255])
+CONV_INLINE void conv_storeBytes(uint8_t *p, const t_convVec f[4], t_convRounding rounding) {
+    for (int j = 0; j < 4; j++) {
+        _mm_storeu_si128((__m128i *)(p + 16 * j), _mm512_cvtepi32_epi8(conv_toInt(f[j], rounding)));
+    }
+}
+
+// Normalize 32 sums: clamp negatives to 0, add the bias and divide
+CONV_INLINE __m512i conv_divide16(__m512i sum, const t_intDivide *div) {
+    sum = _mm512_max_epi16(sum, _mm512_setzero_si512());
+    sum = _mm512_add_epi16(sum, _mm512_set1_epi16((short)div->bias));
+    if (div->divisor > 1) {
+        sum = _mm512_mulhi_epu16(sum, _mm512_set1_epi16((short)div->magic));
+        sum = _mm512_srl_epi16(sum, _mm_cvtsi32_si128(div->shift));
+    }
+    return sum;
+}
+
+// Vector integer convolution of the samples [begin, end) of one row, 16-bit sums.
+// The last block is shifted back to end exactly at end.
+static CONV_TARGET void conv_vectorInt(const t_intTap *taps, int count, int begin, int end,
+                                       uint8_t *out, const t_intDivide *div) {
+    for (int i = begin; i < end; i += 64) {
+        if (i > end - 64) i = end - 64;
+        __m512i lo = _mm512_setzero_si512(), hi = _mm512_setzero_si512();
+        for (int t = 0; t < count; t++) {
+            __m512i w = _mm512_set1_epi16(taps[t].weight);
+            const uint8_t *p = taps[t].src + i;
+            __m512i a = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)p));
+            __m512i b = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i *)(p + 32)));
+            lo = _mm512_add_epi16(lo, _mm512_mullo_epi16(a, w));
+            hi = _mm512_add_epi16(hi, _mm512_mullo_epi16(b, w));
+        }
+        // Saturating narrow, like the packs of the other instruction sets
+        _mm256_storeu_si256((__m256i *)(out + i), _mm512_cvtusepi16_epi8(conv_divide16(lo, div)));
+        _mm256_storeu_si256((__m256i *)(out + i + 32),
+                            _mm512_cvtusepi16_epi8(conv_divide16(hi, div)));
+    }
+}
+
+#elif defined(CONV_AVX2)
+
+typedef __m256 t_convVec;
+
+// Load 32 bytes as four vectors of 8 floats
+CONV_INLINE void conv_loadBytes(const uint8_t *p, t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)(p + 8 * j));
+        f[j] = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+    }
+}
+
+// Load 32 consecutive floats as four vectors
+CONV_INLINE void conv_loadFloats(const float *p, t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) f[j] = _mm256_loadu_ps(p + 8 * j);
+}
+
+// Store four vectors as 32 consecutive floats
+CONV_INLINE void conv_storeFloats(float *p, const t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) _mm256_storeu_ps(p + 8 * j, f[j]);
+}
+
+CONV_INLINE t_convVec conv_set1(float v) { return _mm256_set1_ps(v); }
+CONV_INLINE t_convVec conv_zero(void) { return _mm256_setzero_ps(); }
+CONV_INLINE t_convVec conv_add(t_convVec a, t_convVec b) { return _mm256_add_ps(a, b); }
+CONV_INLINE t_convVec conv_mul(t_convVec a, t_convVec b) { return _mm256_mul_ps(a, b); }
+
+// Convert a float vector to integers with the scalar rounding rule
+CONV_INLINE __m256i conv_toInt(t_convVec v, t_convRounding rounding) {
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+    __m256i t = _mm256_cvttps_epi32(v);
+    if (rounding == CONV_ROUND) {
+        // roundf on non-negative values: add one when the fraction is >= 0.5
+        __m256 frac = _mm256_sub_ps(v, _mm256_cvtepi32_ps(t));
+        __m256 up = _mm256_cmp_ps(frac, _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+        t = _mm256_sub_epi32(t, _mm256_castps_si256(up));
+    }
+    return t;
+}
+
+// Narrow four float vectors to 32 bytes with saturating packs
+CONV_INLINE void conv_storeBytes(uint8_t *p, const t_convVec f[4], t_convRounding rounding) {
+    __m256i ab = _mm256_packs_epi32(conv_toInt(f[0], rounding), conv_toInt(f[1], rounding));
+    __m256i cd = _mm256_packs_epi32(conv_toInt(f[2], rounding), conv_toInt(f[3], rounding));
+    __m256i bytes = _mm256_packus_epi16(ab, cd);
+    // Packs work per 128-bit lane: put the 4-byte groups back in order
+    bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm256_storeu_si256((__m256i *)p, bytes);
+}
+
+// Normalize 16 sums: clamp negatives to 0, add the bias and divide
+CONV_INLINE __m256i conv_divide16(__m256i sum, const t_intDivide *div) {
+    sum = _mm256_max_epi16(sum, _mm256_setzero_si256());
+    sum = _mm256_add_epi16(sum, _mm256_set1_epi16((short)div->bias));
+    if (div->divisor > 1) {
+        sum = _mm256_mulhi_epu16(sum, _mm256_set1_epi16((short)div->magic));
+        sum = _mm256_srl_epi16(sum, _mm_cvtsi32_si128(div->shift));
+    }
+    return sum;
+}
+
+// Vector integer convolution of the samples [begin, end) of one row, 16-bit sums.
+// The last block is shifted back to end exactly at end.
+static CONV_TARGET void conv_vectorInt(const t_intTap *taps, int count, int begin, int end,
+                                       uint8_t *out, const t_intDivide *div) {
+    for (int i = begin; i < end; i += 32) {
+        if (i > end - 32) i = end - 32;
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        for (int t = 0; t < count; t++) {
+            __m256i w = _mm256_set1_epi16(taps[t].weight);
+            const uint8_t *p = taps[t].src + i;
+            __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+            __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p + 16)));
+            lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(a, w));
+            hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(b, w));
+        }
+        __m256i bytes = _mm256_packus_epi16(conv_divide16(lo, div), conv_divide16(hi, div));
+        // Packs work per 128-bit lane: put the 8-byte groups back in order
+        bytes = _mm256_permute4x64_epi64(bytes, 0xD8);
+        _mm256_storeu_si256((__m256i *)(out + i), bytes);
+    }
+}
+
+#else
+
+typedef __m128 t_convVec;
+
+// Load 16 bytes as four vectors of 4 floats
+CONV_INLINE void conv_loadBytes(const uint8_t *p, t_convVec f[4]) {
+    __m128i bytes = _mm_loadu_si128((const __m128i *)p);
+    f[0] = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes));
+    f[1] = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4)));
+    f[2] = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 8)));
+    f[3] = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(bytes, 12)));
+}
+
+// Load 16 consecutive floats as four vectors
+CONV_INLINE void conv_loadFloats(const float *p, t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) f[j] = _mm_loadu_ps(p + 4 * j);
+}
+
+// Store four vectors as 16 consecutive floats
+CONV_INLINE void conv_storeFloats(float *p, const t_convVec f[4]) {
+    for (int j = 0; j < 4; j++) _mm_storeu_ps(p + 4 * j, f[j]);
+}
+
+CONV_INLINE t_convVec conv_set1(float v) { return _mm_set1_ps(v); }
+CONV_INLINE t_convVec conv_zero(void) { return _mm_setzero_ps(); }
+CONV_INLINE t_convVec conv_add(t_convVec a, t_convVec b) { return _mm_add_ps(a, b); }
+CONV_INLINE t_convVec conv_mul(t_convVec a, t_convVec b) { return _mm_mul_ps(a, b); }
+
+// Convert a float vector to integers with the scalar rounding rule
+CONV_INLINE __m128i conv_toInt(t_convVec v, t_convRounding rounding) {
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+    __m128i t = _mm_cvttps_epi32(v);
+    if (rounding == CONV_ROUND) {
+        // roundf on non-negative values: add one when the fraction is >= 0.5
+        __m128 frac = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+        __m128 up = _mm_cmpge_ps(frac, _mm_set1_ps(0.5f));
+        t = _mm_sub_epi32(t, _mm_castps_si128(up));
+    }
+    return t;
+}
+
+// Narrow four float vectors to 16 bytes with saturating packs
+CONV_INLINE void conv_storeBytes(uint8_t *p, const t_convVec f[4], t_convRounding rounding) {
+    __m128i ab = _mm_packs_epi32(conv_toInt(f[0], rounding), conv_toInt(f[1], rounding));
+    __m128i cd = _mm_packs_epi32(conv_toInt(f[2], rounding), conv_toInt(f[3], rounding));
+    _mm_storeu_si128((__m128i *)p, _mm_packus_epi16(ab, cd));
+}
+
+// Normalize 8 sums: clamp negatives to 0, add the bias and divide
+CONV_INLINE __m128i conv_divide16(__m128i sum, const t_intDivide *div) {
+    sum = _mm_max_epi16(sum, _mm_setzero_si128());
+    sum = _mm_add_epi16(sum, _mm_set1_epi16((short)div->bias));
+    if (div->divisor > 1) {
+        sum = _mm_mulhi_epu16(sum, _mm_set1_epi16((short)div->magic));
+        sum = _mm_srl_epi16(sum, _mm_cvtsi32_si128(div->shift));
+    }
+    return sum;
+}
+
+// Vector integer convolution of the samples [begin, end) of one row, 16-bit sums.
+// The last block is shifted back to end exactly at end.
+static CONV_TARGET void conv_vectorInt(const t_intTap *taps, int count, int begin, int end,
+                                       uint8_t *out, const t_intDivide *div) {
+    for (int i = begin; i < end; i += 16) {
+        if (i > end - 16) i = end - 16;
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        for (int t = 0; t < count; t++) {
+            __m128i w = _mm_set1_epi16(taps[t].weight);
+            __m128i bytes = _mm_loadu_si128((const __m128i *)(taps[t].src + i));
+            lo = _mm_add_epi16(lo, _mm_mullo_epi16(_mm_cvtepu8_epi16(bytes), w));
+            hi = _mm_add_epi16(hi, _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8)), w));
+        }
+        _mm_storeu_si128((__m128i *)(out + i),
+                         _mm_packus_epi16(conv_divide16(lo, div), conv_divide16(hi, div)));
+    }
+}
+
+#endif
+
+// Vector 2D convolution of the samples [begin, end) of one row, which must all
+// be at least kernelSize / 2 pixels away from the left and right edges.
+// The last block is shifted back to end exactly at end (recomputing a few samples).
+CONV_INLINE void conv_vector2D(const uint8_t *const *rows, float *const *coeffs, int count,
+                               int kernelSize, int channels, int begin, int end, uint8_t *out,
+                               t_convRounding rounding) {
+    int n = kernelSize / 2;
+    for (int i = begin; i < end; i += CONV_VECTOR) {
+        if (i > end - CONV_VECTOR) i = end - CONV_VECTOR;
+        t_convVec acc[4] = { conv_zero(), conv_zero(), conv_zero(), conv_zero() };
+        for (int r = 0; r < count; r++) {
+            for (int kx = 0; kx < kernelSize; kx++) {
+                t_convVec in[4];
+                t_convVec k = conv_set1(coeffs[r][kx]);
+                conv_loadBytes(rows[r] + i + (kx - n) * channels, in);
+                for (int j = 0; j < 4; j++) acc[j] = conv_add(acc[j], conv_mul(in[j], k));
+            }
+        }
+        conv_storeBytes(out + i, acc, rounding);
+    }
+}
+
+// 3x3 and 5x5 get their own copies so the tap loops are fully unrolled
+static CONV_TARGET void conv_vector2D3(const uint8_t *const *rows, float *const *coeffs,
+                                       int count, int channels, int begin, int end, uint8_t *out,
+                                       t_convRounding rounding) {
+    conv_vector2D(rows, coeffs, count, 3, channels, begin, end, out, rounding);
+}
+
+static CONV_TARGET void conv_vector2D5(const uint8_t *const *rows, float *const *coeffs,
+                                       int count, int channels, int begin, int end, uint8_t *out,
+                                       t_convRounding rounding) {
+    conv_vector2D(rows, coeffs, count, 5, channels, begin, end, out, rounding);
+}
+
+static CONV_TARGET void conv_vector2DN(const uint8_t *const *rows, float *const *coeffs,
+                                       int count, int kernelSize, int channels, int begin,
+                                       int end, uint8_t *out, t_convRounding rounding) {
+    conv_vector2D(rows, coeffs, count, kernelSize, channels, begin, end, out, rounding);
+}
+
+// Vector vertical pass: tmp[i] = sum of column[r] * rows[r][i], for whole blocks
+// of [0, length). Returns how many samples were done; the caller finishes the tail.
+static CONV_TARGET int conv_vectorColumn(const uint8_t *const *rows, const float *column,
+                                         int count, int length, float *tmp) {
+    int i = 0;
+    for (; i + CONV_VECTOR <= length; i += CONV_VECTOR) {
+        t_convVec acc[4] = { conv_zero(), conv_zero(), conv_zero(), conv_zero() };
+        for (int r = 0; r < count; r++) {
+            t_convVec in[4];
+            t_convVec k = conv_set1(column[r]);
+            conv_loadBytes(rows[r] + i, in);
+            for (int j = 0; j < 4; j++) acc[j] = conv_add(acc[j], conv_mul(in[j], k));
+        }
+        conv_storeFloats(tmp + i, acc);
+    }
+    return i;
+}
+
+// Vector horizontal pass of the separable path over the samples [begin, end),
+// which must all be at least kernelSize / 2 pixels away from the edges
+static CONV_TARGET void conv_vectorRow(const float *tmp, const float *row, int kernelSize,
+                                       int channels, int begin, int end, uint8_t *out,
+                                       t_convRounding rounding) {
+    int n = kernelSize / 2;
+    for (int i = begin; i < end; i += CONV_VECTOR) {
+        if (i > end - CONV_VECTOR) i = end - CONV_VECTOR;
+        t_convVec acc[4] = { conv_zero(), conv_zero(), conv_zero(), conv_zero() };
+        for (int kx = 0; kx < kernelSize; kx++) {
+            t_convVec in[4];
+            t_convVec k = conv_set1(row[kx]);
+            conv_loadFloats(tmp + i + (kx - n) * channels, in);
+            for (int j = 0; j < 4; j++) acc[j] = conv_add(acc[j], conv_mul(in[j], k));
+        }
+        conv_storeBytes(out + i, acc, rounding);
+    }
+}
+
+static const t_convKernels conv_kernels = {
+    CONV_VECTOR, conv_vector2D3, conv_vector2D5, conv_vector2DN, conv_vectorColumn,
+    conv_vectorRow, conv_vectorInt
+};
+
+#undef CONV_SSE42
+#undef CONV_AVX2
+#undef CONV_AVX512
+#undef CONV_SUFFIX
+#undef CONV_TARGET
+#undef CONV_VECTOR
+#undef CONV_PASTE
+#undef CONV_EXPAND
+#undef CONV_NAME
+#undef CONV_INLINE
+#undef t_convVec
+#undef conv_loadBytes
+#undef conv_loadFloats
+#undef conv_storeFloats
+#undef conv_set1
+#undef conv_zero
+#undef conv_add
+#undef conv_mul
+#undef conv_toInt
+#undef conv_storeBytes
+#undef conv_vector2D
+#undef conv_vector2D3
+#undef conv_vector2D5
+#undef conv_vector2DN
+#undef conv_vectorColumn
+#undef conv_vectorRow
+#undef conv_divide16
+#undef conv_vectorInt
+#undef conv_kernels
@@ -0,0 +1,59 @@
+#include "cpu.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static const char *cpu_names[] = { "scalar", "sse4.2", "avx2", "avx512" };
+
+static pthread_once_t cpu_once = PTHREAD_ONCE_INIT;
+static t_cpuLevel cpu_supported = CPU_SCALAR;
+static int cpu_vbmi = 0;
+static t_cpuLevel cpu_current = CPU_SCALAR;
+
+// Ask the CPU what it supports and apply IMGFUN_ISA
+static void cpu_init(void) {
+#if CPU_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) cpu_supported = CPU_SSE42;
+    if (__builtin_cpu_supports("avx2")) cpu_supported = CPU_AVX2;
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        cpu_supported = CPU_AVX512;
+        cpu_vbmi = __builtin_cpu_supports("avx512vbmi");
+    }
+#endif
+    cpu_current = cpu_supported;
+
+    const char *env = getenv("IMGFUN_ISA");
+    for (int i = 0; env && i <= CPU_AVX512; i++) {
+        if (strcmp(env, cpu_names[i]) == 0 && i < (int)cpu_supported) cpu_current = (t_cpuLevel)i;
+    }
+}
+
+// Get the instruction set the kernels use
+t_cpuLevel cpu_level(void) {
+    pthread_once(&cpu_once, cpu_init);
+    return cpu_current;
+}
+
+// Get the best instruction set the CPU supports
+t_cpuLevel cpu_detect(void) {
+    pthread_once(&cpu_once, cpu_init);
+    return cpu_supported;
+}
+
+// Make the kernels use another instruction set
+t_cpuLevel cpu_setLevel(t_cpuLevel level) {
+    pthread_once(&cpu_once, cpu_init);
+    cpu_current = level < cpu_supported ? level : cpu_supported;
+    return cpu_current;
+}
+
+// Tell whether the AVX-512 lookup table kernels are in use
+int cpu_hasVbmi(void) {
+    return cpu_level() == CPU_AVX512 && cpu_vbmi;
+}
+
+// Get the name of an instruction set
+const char *cpu_levelName(t_cpuLevel level) {
+    return level >= CPU_SCALAR && level <= CPU_AVX512 ? cpu_names[level] : "unknown";
+}
@@ -0,0 +1,42 @@
+#ifndef CPU_H
+#define CPU_H
+
+// Instruction sets the image kernels are built for, from the slowest. Every kernel
+// gives the same result whichever one runs.
+typedef enum {
+    CPU_SCALAR,  // Plain C
+    CPU_SSE42,   // SSE4.2
+    CPU_AVX2,    // AVX2
+    CPU_AVX512   // AVX-512 F and BW (and VBMI for the lookup tables, when present)
+} t_cpuLevel;
+
+// The vector variants exist on x86 only; elsewhere every kernel is plain C
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#define CPU_TARGET_SSE42 __attribute__((target("sse4.2")))
+#define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#define CPU_TARGET_AVX512VBMI __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+#else
+#define CPU_X86 0
+#endif
+
+// Function to get the instruction set the kernels use. Chosen on first use: the best
+// the CPU supports, or the one named by the IMGFUN_ISA environment variable (scalar,
+// sse4.2, avx2 or avx512) when the CPU supports it.
+t_cpuLevel cpu_level(void);
+
+// Function to get the best instruction set the CPU supports
+t_cpuLevel cpu_detect(void);
+
+// Function to make the kernels use another instruction set, lowered to what the CPU
+// supports. Returns the one set. Must not be called while a kernel is running.
+t_cpuLevel cpu_setLevel(t_cpuLevel level);
+
+// Function to tell whether the AVX-512 lookup table kernels (VBMI) are in use
+int cpu_hasVbmi(void);
+
+// Function to get the name of an instruction set, as IMGFUN_ISA takes it
+const char *cpu_levelName(t_cpuLevel level);
+
+#endif // CPU_H
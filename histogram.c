@@ -0,0 +1,334 @@
+#include "histogram.h"
+#include "pointwise.h"
+#include "threadpool.h"
+#include "cpu.h"
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+// Sub-histograms per counted plane: consecutive pixels go to different banks
+#define HIST_BANKS 4
+
+// Minimum number of samples in a band of rows handed to one thread
+#define HIST_BAND_SAMPLES 65536
+
+// Planes counted per band: one per channel, then the luma
+#define HIST_PLANES (HIST_CHANNELS + 1)
+
+// Fractional bits of the bilinear weights between tile maps
+#define HIST_WEIGHT_BITS 8
+
+// Pixels of an RGB row whose luma is computed in one go before they are counted
+#define HIST_LUMA_CHUNK 256
+
+// Computes the luma of width RGB pixels
+typedef void (*t_histLumaRow)(const uint8_t *rgb, int width, uint8_t *luma);
+
+// Parameters shared by the row bands of one count
+typedef struct {
+    const t_raster *raster;
+    t_histogram *hist;       // Histogram the band counts are merged into
+    t_histLumaRow lumaRow;   // Luma of the RGB rows
+    pthread_mutex_t lock;    // Protects hist
+} t_histJob;
+
+// Parameters shared by the tiles and the row bands of one CLAHE
+typedef struct {
+    const t_raster *raster;
+    int tileSize;
+    int tilesX, tilesY;      // Number of tiles across and down
+    float clipLimit;
+    uint8_t (*maps)[256];    // Equalization map of every tile, row by row
+    int *tileX;              // Per column: the tile center on its left (clamped)
+    int *weightX;            // Per column: weight of the tile on the right
+} t_claheJob;
+
+// Count the rows [y0, y1) of a 1-channel raster
+static void hist_countGray(const t_raster *raster, int y0, int y1,
+                           unsigned int banks[HIST_BANKS][HIST_PLANES][256]) {
+    int width = raster->width;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *p = raster->data + (size_t)y * raster->stride;
+        int x = 0;
+        for (; x + HIST_BANKS <= width; x += HIST_BANKS) {
+            banks[0][0][p[x]]++;
+            banks[1][0][p[x + 1]]++;
+            banks[2][0][p[x + 2]]++;
+            banks[3][0][p[x + 3]]++;
+        }
+        for (; x < width; x++) banks[0][0][p[x]]++;
+    }
+}
+
+// Luma of a row as the float formula rounded like roundf (the fraction is exact),
+// which hist_luma always agrees with. Branch-free, so it vectorizes; always inlined
+// into one copy per instruction set.
+static inline __attribute__((always_inline))
+void hist_lumaFloat(const uint8_t *restrict rgb, int width, uint8_t *restrict luma) {
+    for (int x = 0; x < width; x++) {
+        float f = 0.299f * rgb[3 * x] + 0.587f * rgb[3 * x + 1] + 0.114f * rgb[3 * x + 2];
+        int t = (int)f;
+        luma[x] = (uint8_t)(t + (f - t >= 0.5f));
+    }
+}
+
+// Scalar luma of a row: the reference the vector copies are checked against
+static void hist_lumaScalar(const uint8_t *rgb, int width, uint8_t *luma) {
+    for (int x = 0; x < width; x++) luma[x] = hist_luma(rgb[3 * x], rgb[3 * x + 1], rgb[3 * x + 2]);
+}
+
+#if CPU_X86
+static CPU_TARGET_SSE42 void hist_lumaSse42(const uint8_t *rgb, int width, uint8_t *luma) {
+    hist_lumaFloat(rgb, width, luma);
+}
+
+static CPU_TARGET_AVX2 void hist_lumaAvx2(const uint8_t *rgb, int width, uint8_t *luma) {
+    hist_lumaFloat(rgb, width, luma);
+}
+
+static CPU_TARGET_AVX512 void hist_lumaAvx512(const uint8_t *rgb, int width, uint8_t *luma) {
+    hist_lumaFloat(rgb, width, luma);
+}
+#endif
+
+// Luma row function of the instruction set cpu_level() picks
+static t_histLumaRow hist_selectLuma(void) {
+#if CPU_X86
+    switch (cpu_level()) {
+        case CPU_AVX512:
+            return hist_lumaAvx512;
+        case CPU_AVX2:
+            return hist_lumaAvx2;
+        case CPU_SSE42:
+            return hist_lumaSse42;
+        default:
+            break;
+    }
+#endif
+    return hist_lumaScalar;
+}
+
+// Compute the luma of a row of RGB pixels
+void hist_lumaRow(const uint8_t *rgb, int width, uint8_t *luma) {
+    hist_selectLuma()(rgb, width, luma);
+}
+
+// Count the channels of one RGB pixel and its luma into a bank
+static inline void hist_countPixel(const uint8_t *p, uint8_t luma,
+                                   unsigned int bank[HIST_PLANES][256]) {
+    bank[0][p[0]]++;
+    bank[1][p[1]]++;
+    bank[2][p[2]]++;
+    bank[3][luma]++;
+}
+
+// Count the rows [y0, y1) of a 3-channel raster, computing the luma a chunk at a time
+static void hist_countRGB(const t_raster *raster, int y0, int y1, t_histLumaRow lumaRow,
+                          unsigned int banks[HIST_BANKS][HIST_PLANES][256]) {
+    uint8_t luma[HIST_LUMA_CHUNK];
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *row = raster->data + (size_t)y * raster->stride;
+        for (int x0 = 0; x0 < raster->width; x0 += HIST_LUMA_CHUNK) {
+            int width = raster->width - x0 < HIST_LUMA_CHUNK ? raster->width - x0 : HIST_LUMA_CHUNK;
+            const uint8_t *p = row + 3 * x0;
+            lumaRow(p, width, luma);
+            int x = 0;
+            for (; x + HIST_BANKS <= width; x += HIST_BANKS) {
+                hist_countPixel(p + 3 * x, luma[x], banks[0]);
+                hist_countPixel(p + 3 * x + 3, luma[x + 1], banks[1]);
+                hist_countPixel(p + 3 * x + 6, luma[x + 2], banks[2]);
+                hist_countPixel(p + 3 * x + 9, luma[x + 3], banks[3]);
+            }
+            for (; x < width; x++) hist_countPixel(p + 3 * x, luma[x], banks[0]);
+        }
+    }
+}
+
+// Count the rows [y0, y1) and merge the band counts into the job histogram
+static void hist_rows(void *context, int y0, int y1) {
+    t_histJob *job = context;
+    const t_raster *raster = job->raster;
+    unsigned int banks[HIST_BANKS][HIST_PLANES][256];
+    memset(banks, 0, sizeof(banks));
+
+    if (raster->channels == 1) hist_countGray(raster, y0, y1, banks);
+    else hist_countRGB(raster, y0, y1, job->lumaRow, banks);
+
+    t_histogram *hist = job->hist;
+    pthread_mutex_lock(&job->lock);
+    for (int c = 0; c < HIST_PLANES; c++) {
+        unsigned int *out = c < HIST_CHANNELS ? hist->channel[c] : hist->luma;
+        for (int v = 0; v < 256; v++) {
+            out[v] += banks[0][c][v] + banks[1][c][v] + banks[2][c][v] + banks[3][c][v];
+        }
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Count every channel and the luma of a raster in a single pass
+int hist_compute(const t_raster *raster, t_histogram *hist) {
+    if (raster->channels != 1 && raster->channels != 3) return -1;
+    memset(hist, 0, sizeof(*hist));
+    if (raster->width <= 0 || raster->height <= 0) return 0;
+
+    t_histJob job = { .raster = raster, .hist = hist, .lumaRow = hist_selectLuma() };
+    int rowLength = raster->width * raster->channels;
+    int grain = rowLength >= HIST_BAND_SAMPLES ? 1 : HIST_BAND_SAMPLES / rowLength;
+    pthread_mutex_init(&job.lock, NULL);
+    pool_parallelFor(raster->height, grain, hist_rows, &job);
+    pthread_mutex_destroy(&job.lock);
+
+    if (raster->channels == 1) memcpy(hist->luma, hist->channel[0], sizeof(hist->luma));
+    return 0;
+}
+
+// Turn a histogram into a cumulative one
+void hist_cumulate(const unsigned int *hist, unsigned int *cdf) {
+    unsigned int sum = 0;
+    for (int v = 0; v < 256; v++) {
+        sum += hist[v];
+        cdf[v] = sum;
+    }
+}
+
+// Clip a histogram at limit and spread the excess evenly over all the bins
+static void hist_clip(unsigned int *hist, unsigned int limit) {
+    unsigned int excess = 0;
+    for (int v = 0; v < 256; v++) {
+        if (hist[v] > limit) {
+            excess += hist[v] - limit;
+            hist[v] = limit;
+        }
+    }
+    unsigned int each = excess / 256;
+    unsigned int rest = excess % 256;
+    for (int v = 0; v < 256; v++) hist[v] += each;
+    // What is left goes to bins spread across the whole range
+    if (rest > 0) {
+        unsigned int step = 256 / rest;
+        for (unsigned int v = 0; v < 256 && rest > 0; v += step, rest--) hist[v]++;
+    }
+}
+
+// Build the equalization maps of the tiles [begin, end)
+static void hist_claheTiles(void *context, int begin, int end) {
+    t_claheJob *job = context;
+    const t_raster *raster = job->raster;
+    int size = job->tileSize;
+
+    for (int tile = begin; tile < end; tile++) {
+        int x0 = tile % job->tilesX * size;
+        int y0 = tile / job->tilesX * size;
+        int width = raster->width - x0 < size ? raster->width - x0 : size;
+        int height = raster->height - y0 < size ? raster->height - y0 : size;
+        unsigned int total = (unsigned int)width * height;
+
+        // Tiles are small: a plain count beats setting up the banked one
+        unsigned int hist[256] = {0};
+        for (int y = y0; y < y0 + height; y++) {
+            const uint8_t *p = raster->data + (size_t)y * raster->stride + x0;
+            for (int x = 0; x < width; x++) hist[p[x]]++;
+        }
+        if (job->clipLimit > 0.0f) {
+            float limit = job->clipLimit * total / 256.0f;
+            hist_clip(hist, limit < 1.0f ? 1 : (unsigned int)limit);
+        }
+        unsigned int cdf[256];
+        hist_cumulate(hist, cdf);
+
+        t_lut lut;
+        lut_identity(&lut);
+        lut_equalize(&lut, 0, cdf, total);
+        memcpy(job->maps[tile], lut.table[0], 256);
+    }
+}
+
+// Tile center at or before position p, and the weight of the next one, along an axis
+// split into count tiles of size pixels. Outside the first and last centers only one
+// tile is used.
+static void hist_claheAxis(int p, int size, int count, int *tile, int *weight) {
+    // Distance from the first center, in half pixels
+    int offset = 2 * p + 1 - size;
+    if (offset <= 0) {
+        *tile = 0;
+        *weight = 0;
+        return;
+    }
+    *tile = offset / (2 * size);
+    if (*tile >= count - 1) {
+        *tile = count - 1;
+        *weight = 0;
+        return;
+    }
+    int within = offset - *tile * 2 * size;
+    *weight = (within << HIST_WEIGHT_BITS) / (2 * size);
+}
+
+// Blend the four nearest tile maps over the rows [y0, y1)
+static void hist_claheRows(void *context, int y0, int y1) {
+    t_claheJob *job = context;
+    const t_raster *raster = job->raster;
+    const int *tileX = job->tileX;
+    const int *weightX = job->weightX;
+    const int tilesX = job->tilesX;
+    const int width = raster->width;
+    const int round = 1 << (2 * HIST_WEIGHT_BITS - 1);
+
+    for (int y = y0; y < y1; y++) {
+        int ty, wy;
+        hist_claheAxis(y, job->tileSize, job->tilesY, &ty, &wy);
+        int below = ty + 1 < job->tilesY ? ty + 1 : ty;
+        const uint8_t (*top)[256] = (const uint8_t (*)[256])job->maps + (size_t)ty * tilesX;
+        const uint8_t (*bottom)[256] = (const uint8_t (*)[256])job->maps + (size_t)below * tilesX;
+
+        uint8_t *p = raster->data + (size_t)y * raster->stride;
+        int x = 0;
+        while (x < width) {
+            // Columns sharing the same pair of tiles
+            int tx = tileX[x];
+            int right = tx + 1 < tilesX ? tx + 1 : tx;
+            int end = x + 1;
+            while (end < width && tileX[end] == tx) end++;
+
+            const uint8_t *m00 = top[tx], *m01 = top[right];
+            const uint8_t *m10 = bottom[tx], *m11 = bottom[right];
+            for (; x < end; x++) {
+                int wx = weightX[x];
+                int v = p[x];
+                int upper = (m00[v] << HIST_WEIGHT_BITS) + wx * (m01[v] - m00[v]);
+                int lower = (m10[v] << HIST_WEIGHT_BITS) + wx * (m11[v] - m10[v]);
+                p[x] = (uint8_t)(((upper << HIST_WEIGHT_BITS) + wy * (lower - upper) + round)
+                                 >> (2 * HIST_WEIGHT_BITS));
+            }
+        }
+    }
+}
+
+// Apply contrast-limited adaptive histogram equalization to a 1-channel raster
+int hist_clahe(const t_raster *raster, int tileSize, float clipLimit) {
+    if (raster->channels != 1 || tileSize < HIST_MIN_TILE) return -1;
+    if (raster->width <= 0 || raster->height <= 0) return 0;
+
+    t_claheJob job = { .raster = raster, .tileSize = tileSize, .clipLimit = clipLimit };
+    job.tilesX = (raster->width + tileSize - 1) / tileSize;
+    job.tilesY = (raster->height + tileSize - 1) / tileSize;
+    job.maps = malloc((size_t)job.tilesX * job.tilesY * sizeof(*job.maps));
+    job.tileX = malloc(raster->width * sizeof(int));
+    job.weightX = malloc(raster->width * sizeof(int));
+    if (!job.maps || !job.tileX || !job.weightX) {
+        free(job.maps); free(job.tileX); free(job.weightX);
+        return -1;
+    }
+
+    for (int x = 0; x < raster->width; x++) {
+        hist_claheAxis(x, tileSize, job.tilesX, &job.tileX[x], &job.weightX[x]);
+    }
+
+    // Every map is built before any pixel changes
+    pool_parallelFor(job.tilesX * job.tilesY, 1, hist_claheTiles, &job);
+    int grain = raster->width >= HIST_BAND_SAMPLES ? 1 : HIST_BAND_SAMPLES / raster->width;
+    pool_parallelFor(raster->height, grain, hist_claheRows, &job);
+
+    free(job.maps); free(job.tileX); free(job.weightX);
+    return 0;
+}
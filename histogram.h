@@ -0,0 +1,56 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+#include <stdint.h>
+#include <math.h>
+#include "convolution.h"
+
+// Most channels a histogram counts separately
+#define HIST_CHANNELS 3
+
+// Value counts of every channel of a raster, and of its luma. Channel c counts
+// sample c of each pixel. 3-channel rasters are taken as red, green, blue; the
+// luma of a 1-channel raster is its only channel.
+typedef struct {
+    unsigned int channel[HIST_CHANNELS][256];
+    unsigned int luma[256];
+} t_histogram;
+
+// Function to get the BT.601 luma 0.299 r + 0.587 g + 0.114 b rounded to the nearest level.
+// Computed exactly in integers; exact halves (about 1 pixel in 1000) are rounded the way
+// the float formula does, so the result always agrees with roundf of it.
+static inline uint8_t hist_luma(uint8_t r, uint8_t g, uint8_t b) {
+    int sum = 299 * r + 587 * g + 114 * b;
+    int luma = (sum + 500) / 1000;
+    if (sum - 1000 * luma == -500) luma = (int)roundf(0.299f * r + 0.587f * g + 0.114f * b);
+    return (uint8_t)luma;
+}
+
+// Function to compute the luma of a row of width RGB pixels, as hist_luma does, with the
+// vector code of the instruction set cpu_level() picks
+void hist_lumaRow(const uint8_t *rgb, int width, uint8_t *luma);
+
+// Function to count every channel and the luma of a raster in a single pass.
+// Interleaved sub-histograms keep runs of equal values from stalling on one counter;
+// large rasters are counted in parallel bands merged at the end.
+// Returns 0, or -1 unless the raster has 1 or 3 channels.
+int hist_compute(const t_raster *raster, t_histogram *hist);
+
+// Function to turn a histogram into a cumulative one: cdf[v] counts the values <= v
+void hist_cumulate(const unsigned int *hist, unsigned int *cdf);
+
+// Smallest tile side accepted by hist_clahe
+#define HIST_MIN_TILE 8
+
+// Usual CLAHE settings: tile side in pixels and clip limit
+#define HIST_CLAHE_TILE 64
+#define HIST_CLAHE_CLIP 3.0f
+
+// Function to apply contrast-limited adaptive histogram equalization (CLAHE) to a
+// 1-channel raster, in place. Every tileSize x tileSize tile gets its own equalization
+// map, built from its histogram clipped at clipLimit times the mean bin count (the
+// excess is spread over all bins; clipLimit <= 0 means no limit). Each pixel then
+// blends the maps of the four nearest tile centers bilinearly, in one pass.
+// Returns 0, or -1 on a wrong raster or tile size, or an allocation failure.
+int hist_clahe(const t_raster *raster, int tileSize, float clipLimit);
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,53 @@
+#include "imgfun.h"
+#include <stdio.h>
+#include <stdarg.h>
+
+// Longest message handed to the log function
+#define IMGFUN_MAX_MESSAGE 512
+
+// Where messages go, shared by every thread
+static t_imgfunLog imgfun_log = NULL;
+static void *imgfun_logContext = NULL;
+
+// Last error of each thread
+static _Thread_local t_imgfunError imgfun_error = IMGFUN_OK;
+
+// Set the function the library's messages go to
+void imgfun_setLog(t_imgfunLog log, void *context) {
+    imgfun_log = log;
+    imgfun_logContext = context;
+}
+
+// Get the last error recorded on the calling thread
+t_imgfunError imgfun_lastError(void) {
+    return imgfun_error;
+}
+
+// Get a short description of an error code
+const char *imgfun_errorString(t_imgfunError error) {
+    switch (error) {
+        case IMGFUN_OK: return "no error";
+        case IMGFUN_ERROR_OPEN: return "file couldn't be opened";
+        case IMGFUN_ERROR_FORMAT: return "unsupported or corrupt BMP";
+        case IMGFUN_ERROR_READ: return "file is truncated";
+        case IMGFUN_ERROR_MEMORY: return "out of memory";
+        case IMGFUN_ERROR_WRITE: return "file couldn't be written";
+        case IMGFUN_ERROR_ARGUMENT: return "parameter out of range";
+    }
+    return "unknown error";
+}
+
+// Record an error and hand its message to the log function
+int imgfun_fail(t_imgfunError error, const char *format, ...) {
+    imgfun_error = error;
+    // Nothing is formatted unless someone listens
+    if (imgfun_log) {
+        char message[IMGFUN_MAX_MESSAGE];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+        imgfun_log(error, message, imgfun_logContext);
+    }
+    return error;
+}
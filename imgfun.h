@@ -0,0 +1,43 @@
+#ifndef IMGFUN_H
+#define IMGFUN_H
+#include "bmp.h"
+#include "stream.h"
+#include "threadpool.h"
+#include "trace.h"
+#include "cpu.h"
+
+// Umbrella header of the image processing library (libimgfun). The library never
+// prints: failures are returned or recorded as the codes below, and their messages
+// only go to the log function, when one is set.
+
+// Error codes. Functions returning int (savers, filters, stream) return 0 or one of these;
+// the loaders return NULL and record it for imgfun_lastError.
+typedef enum {
+    IMGFUN_OK = 0,
+    IMGFUN_ERROR_OPEN = -1,      // The file couldn't be opened or mapped
+    IMGFUN_ERROR_FORMAT = -2,    // Not a BMP the library reads (depth, compression, header)
+    IMGFUN_ERROR_READ = -3,      // The file is shorter than its header says
+    IMGFUN_ERROR_MEMORY = -4,    // An allocation failed
+    IMGFUN_ERROR_WRITE = -5,     // The output file couldn't be written
+    IMGFUN_ERROR_ARGUMENT = -6   // A parameter is out of range for the operation
+} t_imgfunError;
+
+// Receives every message of the library with its error code
+typedef void (*t_imgfunLog)(t_imgfunError error, const char *message, void *context);
+
+// Function to set the function the library's messages go to (NULL, the default, drops them).
+// Set it before calling the library from several threads; it may be called from any of them.
+void imgfun_setLog(t_imgfunLog log, void *context);
+
+// Function to get the last error recorded on the calling thread (IMGFUN_OK if none yet).
+// Only meaningful right after a call that failed.
+t_imgfunError imgfun_lastError(void);
+
+// Function to get a short description of an error code
+const char *imgfun_errorString(t_imgfunError error);
+
+// Function used by the library to record an error on the calling thread and hand its
+// message (printf format) to the log function. Returns error.
+int imgfun_fail(t_imgfunError error, const char *format, ...);
+
+#endif // IMGFUN_H
@@ -1,19 +1,48 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include "bmp8.h"
-#include "bmp24.h"
-
-// Detects if bmp bit is 8 or 24 bit depth
-int detectBitDepth(const char *filename) {
-    FILE *f = fopen(filename, "rb"); // Opening file
-    if (!f) return -1; // if file can't be opened returns error
-    fseek(f, 28, SEEK_SET);
-    uint16_t bits;
-    fread(&bits, sizeof(uint16_t), 1, f);
-    printf("DEBUG bits = %d\n", bits);// Reading BMP bit depth
-    fclose(f); //closing file
-    return (bits == 8 || bits == 24) ? bits : -1;
+#include "imgfun.h"
+#include "cli.h"
+
+// Show the library's messages under the menus
+static void printMessage(t_imgfunError error, const char *message, void *context) {
+    (void)error;
+    (void)context;
+    printf("%s\n", message);
+}
+
+// Print information about an 8-bit BMP image
+static void printInfo8(const t_bmp8 *img) {
+    printf("\nImage information:\n");
+    printf("Width        : %u pixels\n", img->width);
+    printf("Height       : %u pixels\n", img->height);
+    printf("Color Depth  : %u bits\n", img->colorDepth);
+    printf("Image Size   : %u bytes\n", img->dataSize);
+}
+
+// Print a preview of the histogram equalization of an 8 bit image
+static void printEqualization8(const t_bmp8 *img, const unsigned int *cdf) {
+    t_lut lut;
+    lut_identity(&lut);
+    lut_equalize(&lut, -1, cdf, img->width * img->height);
+    const unsigned char *map = lut.table[0];
+
+    printf("\nCDF Preview\n");
+    for (int i = 0; i < 256; i += 32) {
+        printf("cdf[%3d] = %u\n", i, cdf[i]);
+    }
+
+    printf("\nLUT Mapping\n");
+    for (int i = 0; i < 256; i += 32) {
+        printf("map[%3d] = %d\n", i, map[i]);
+    }
+
+    printf("\nSample pixel values\n");
+    for (int i = 0; i < 10; i++) {
+        unsigned char old = img->data[i];
+        unsigned char new = map[old];
+        printf("Pixel[%d]: %d -> %d\n", i, old, new);
+    }
 }
 
 // Filter menu for 8 bit image
@@ -37,35 +66,33 @@ void applyFilters8(t_bmp8 *img) {
         getchar();
 
         switch (choice) {
-            case 1: bmp8_negative(img); printf("Negative applied.\n"); break;
+            case 1: if (bmp8_negative(img) == 0) printf("Negative applied.\n"); break;
             case 2: {
                 int value;
                 printf("Brightness value (-255 to 255): "); //Scale of brightness
                 scanf("%d", &value); getchar();  // Read the user's choice
-                bmp8_brightness(img, value); // Apply filter
-                printf("Brightness adjusted.\n");
+                if (bmp8_brightness(img, value) == 0) printf("Brightness adjusted.\n"); // Apply filter
                 break;
             }
             case 3: {
                 int threshold;
                 printf("Threshold value (0 to 255): "); //level of treshold
                 scanf("%d", &threshold); getchar();// Read the user's choice
-                bmp8_threshold(img, threshold); // Apply filter
-                printf("Threshold applied.\n");
+                if (bmp8_threshold(img, threshold) == 0) printf("Threshold applied.\n"); // Apply filter
                 break;
             }
-            case 4: bmp8_boxBlur(img); printf("Box Blur applied\n"); break; // Apply box blur
-            case 5: bmp8_gaussianBlur(img); printf("Gaussian Blur applied\n"); break; // Apply gaussian blur
-            case 6: bmp8_outline(img); printf("Outline filter applied\n"); break; // Apply outline
-            case 7: bmp8_emboss(img); printf("Emboss filter applied\n"); break; // Apply emboss
-            case 8: bmp8_sharpen(img); printf("Sharpen filter applied\n"); break; // Apply sharpen
+            case 4: if (bmp8_boxBlur(img) == 0) printf("Box Blur applied\n"); break; // Apply box blur
+            case 5: if (bmp8_gaussianBlur(img) == 0) printf("Gaussian Blur applied\n"); break; // Apply gaussian blur
+            case 6: if (bmp8_outline(img) == 0) printf("Outline filter applied\n"); break; // Apply outline
+            case 7: if (bmp8_emboss(img) == 0) printf("Emboss filter applied\n"); break; // Apply emboss
+            case 8: if (bmp8_sharpen(img) == 0) printf("Sharpen filter applied\n"); break; // Apply sharpen
             case 9: {
                 unsigned int *hist = bmp8_computeHistogram(img);
                 unsigned int *cdf = bmp8_computeCDF(hist);
-                bmp8_equalize(img, cdf); // Make histogram
+                printEqualization8(img, cdf); // Preview of the mapping
+                if (bmp8_equalize(img, cdf) == 0) printf("Histogram Equalization applied\n"); // Make histogram
                 free(hist); // reset
                 free(cdf);
-                printf("Histogram Equalization applied\n");
                 break;
             }
             case 10: return; // exit menu
@@ -94,24 +121,22 @@ void applyFilters24(t_bmp24 *img) {
         getchar();
 
         switch (choice) {
-            case 1: bmp24_negative(img); printf("Negative applied.\n"); break; // Apply negative filter 
-            case 2: bmp24_grayscale(img); printf("Grayscale applied.\n"); break; // Apply grayscale
+            case 1: if (bmp24_negative(img) == 0) printf("Negative applied.\n"); break; // Apply negative filter 
+            case 2: if (bmp24_grayscale(img) == 0) printf("Grayscale applied.\n"); break; // Apply grayscale
             case 3: {
                 int value;
                 printf("Brightness value (-255 to 255): ");
                 scanf("%d", &value); getchar(); // Read the brightness that the user want
-                bmp24_brightness(img, value); // Apply brightness
-                printf("Brightness applyied.\n");
+                if (bmp24_brightness(img, value) == 0) printf("Brightness applyied.\n"); // Apply brightness
                 break;
             }
-            case 4: bmp24_boxBlur(img); printf("Box Blur applied.\n"); break; // Apply box blur 
-            case 5: bmp24_gaussianBlur(img); printf("Gaussian Blur applied.\n"); break; // Apply gaussian blur
-            case 6: bmp24_outline(img); printf("Outline filter applied.\n"); break; // Apply outline
-            case 7: bmp24_emboss(img); printf("Emboss filter applied.\n"); break; // Apply emboss
-            case 8: bmp24_sharpen(img); printf("Sharpen filter applied.\n"); break; // Apply sharpen
+            case 4: if (bmp24_boxBlur(img) == 0) printf("Box Blur applied.\n"); break; // Apply box blur 
+            case 5: if (bmp24_gaussianBlur(img) == 0) printf("Gaussian Blur applied.\n"); break; // Apply gaussian blur
+            case 6: if (bmp24_outline(img) == 0) printf("Outline filter applied.\n"); break; // Apply outline
+            case 7: if (bmp24_emboss(img) == 0) printf("Emboss filter applied.\n"); break; // Apply emboss
+            case 8: if (bmp24_sharpen(img) == 0) printf("Sharpen filter applied.\n"); break; // Apply sharpen
             case 9: {
-                bmp24_equalize(img);
-                printf("Histogram Equalization applied.\n");
+                if (bmp24_equalize(img) == 0) printf("Histogram Equalization applied.\n");
                 break;
             }
             case 10: return;
@@ -121,8 +146,11 @@ void applyFilters24(t_bmp24 *img) {
 }
 
 
-// main
-int main(void) {
+// main: interactive menus, or the command-line pipeline when arguments are given
+int main(int argc, char **argv) {
+    if (argc > 1) return cli_run(argc, argv);
+    imgfun_setLog(printMessage, NULL);
+
     char filepath[256]; // file path buffer
     int choice ;
     int bits = -1; // byte depth storing
@@ -154,38 +182,24 @@ int main(void) {
                 printf("Enter file path: ");
                 scanf("%255s", filepath); getchar();
 
-                // detecting bmp depth
-                bits = detectBitDepth(filepath);
-                printf("Looks like there is a problem here : DEBUG detected bits = %d\n", bits);
-
                 // reset previous loaded images
                 if (img8) { bmp8_free(img8); img8 = NULL; }
                 if (img24) { bmp24_free(img24); img24 = NULL; }
 
-                // detects type of image and returns error if doesn't match
-                if (bits == 8) {
-                    img8 = bmp8_loadImage(filepath);
-                    if (!img8) {
-                        printf("Is is not an 8 bit image\n");
-                        bits = -1;
-                    } else {
+                // opens the file once, detects its depth and loads it
+                t_bmp loaded;
+                if (bmp_load(filepath, &loaded) != 0) {
+                    printf("Looks like there is a problem here : wrong format. Please only send 8 or 24 bit images.\n");
+                    bits = -1;
+                } else {
+                    bits = loaded.colorDepth;
+                    img8 = loaded.img8;
+                    img24 = loaded.img24;
+                    if (bits == 8) {
                         printf("8 bit image loaded\n");
-                    }
-                } else if (bits == 24) {
-                    img24 = bmp24_loadImage(filepath);
-                    if (!img24) {
-                        printf("It is not a 24 bit image \n");
-                        bits = -1;
                     } else {
                         printf("24 bit image loaded\n");
-                        // Debug first pixel
-                        printf("DEBUG – First pixel R=%d G=%d B=%d\n",
-                        img24->data[0][0].red,
-                        img24->data[0][0].green,
-                        img24->data[0][0].blue);
                     }
-                } else {
-                    printf("Looks like there is a problem here : wrong format. Please only send 8 or 24 bit images.\n");
                 }
                 break;
             }
@@ -195,11 +209,11 @@ int main(void) {
                 if (bits == 8 && img8) {
                     printf("Please find a name for the outpout image : ");
                     scanf("%255s", filepath); getchar();
-                    bmp8_saveImage(filepath, img8); // Apply save image
+                    if (bmp8_saveImage(filepath, img8) == 0) printf("Image saved in %s\n", filepath);
                 } else if (bits == 24 && img24) {
                     printf("Please find a name for the outpout image :  ");
                     scanf("%255s", filepath); getchar();
-                    bmp24_saveImage(img24, filepath); // Apply save image
+                    if (bmp24_saveImage(img24, filepath) == 0) printf("Image saved in %s\n", filepath);
                 } else {
                     printf("We need to load an image first.\n");
                 }
@@ -215,7 +229,7 @@ int main(void) {
 
             case 4:
                 // display image info
-                if (bits == 8 && img8) bmp8_printInfo(img8);
+                if (bits == 8 && img8) printInfo8(img8);
                 else if (bits == 24 && img24) {
                     printf("Image information:\n");
                     printf("Width       : %d px\n", img24->width); // Print width of the image
@@ -228,6 +242,7 @@ int main(void) {
                 // exit
                 if (img8) bmp8_free(img8);
                 if (img24) bmp24_free(img24);
+                bmp_releaseScratch();
                 printf("See you ! BAERT Astrid & Taha EZZAHRAOUI\n");
                 return 0;
 
@@ -0,0 +1,216 @@
+#include "pointwise.h"
+#include "threadpool.h"
+#include "cpu.h"
+#include <string.h>
+#include <math.h>
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+// Minimum number of samples in a band of rows handed to one thread
+#define LUT_BAND_SAMPLES 65536
+
+// Reset a table to the identity
+void lut_identity(t_lut *lut) {
+    for (int c = 0; c < LUT_CHANNELS; c++) {
+        for (int v = 0; v < 256; v++) lut->table[c][v] = (uint8_t)v;
+    }
+}
+
+// Append an arbitrary map to every channel, or to one channel
+void lut_map(t_lut *lut, int channel, const uint8_t map[256]) {
+    for (int c = 0; c < LUT_CHANNELS; c++) {
+        if (channel >= 0 && c != channel) continue;
+        for (int v = 0; v < 256; v++) lut->table[c][v] = map[lut->table[c][v]];
+    }
+}
+
+// Append a negative
+void lut_negative(t_lut *lut) {
+    uint8_t map[256];
+    for (int v = 0; v < 256; v++) map[v] = (uint8_t)(255 - v);
+    lut_map(lut, -1, map);
+}
+
+// Append a brightness change
+void lut_brightness(t_lut *lut, int value) {
+    uint8_t map[256];
+    for (int v = 0; v < 256; v++) {
+        int temp = v + value;
+        map[v] = temp > 255 ? 255 : (temp < 0 ? 0 : (uint8_t)temp);
+    }
+    lut_map(lut, -1, map);
+}
+
+// Append a threshold
+void lut_threshold(t_lut *lut, int threshold) {
+    uint8_t map[256];
+    for (int v = 0; v < 256; v++) map[v] = v >= threshold ? 255 : 0;
+    lut_map(lut, -1, map);
+}
+
+// Append a gamma correction
+void lut_gamma(t_lut *lut, float gamma) {
+    lut_levels(lut, 0, 255, gamma, 0, 255);
+}
+
+// Append a levels adjustment
+void lut_levels(t_lut *lut, int inBlack, int inWhite, float gamma, int outBlack, int outWhite) {
+    if (inWhite <= inBlack) inWhite = inBlack + 1;
+    if (!(gamma > 0.0f)) gamma = 1.0f;
+
+    uint8_t map[256];
+    for (int v = 0; v < 256; v++) {
+        float t = (float)(v - inBlack) / (float)(inWhite - inBlack);
+        t = fminf(fmaxf(t, 0.0f), 1.0f);
+        float out = outBlack + powf(t, 1.0f / gamma) * (outWhite - outBlack);
+        map[v] = (uint8_t)fminf(fmaxf(roundf(out), 0.0f), 255.0f);
+    }
+    lut_map(lut, -1, map);
+}
+
+// Append the histogram equalization map of a cumulative histogram
+void lut_equalize(t_lut *lut, int channel, const unsigned int *cdf, unsigned int total) {
+    unsigned int cdfMin = 0;
+    for (int i = 0; i < 256; i++) {
+        if (cdf[i] != 0) {
+            cdfMin = cdf[i];
+            break;
+        }
+    }
+    // A single value (or no value at all) has nothing to spread
+    if (total <= cdfMin) return;
+
+    uint8_t map[256];
+    for (int i = 0; i < 256; i++) {
+        if (cdf[i] < cdfMin) {
+            map[i] = 0;
+            continue;
+        }
+        map[i] = (uint8_t)roundf(((float)(cdf[i] - cdfMin) / (total - cdfMin)) * 255.0f);
+    }
+    lut_map(lut, channel, map);
+}
+
+// Tell whether a table leaves every value unchanged
+int lut_isIdentity(const t_lut *lut) {
+    for (int c = 0; c < LUT_CHANNELS; c++) {
+        for (int v = 0; v < 256; v++) {
+            if (lut->table[c][v] != v) return 0;
+        }
+    }
+    return 1;
+}
+
+// Parameters shared by the row bands of one table lookup
+typedef struct {
+    const t_lut *lut;
+    const t_raster *raster;
+    int uniform;   // Non-zero when the raster only needs table[0]
+    int vbmi;      // Non-zero to use the AVX-512 VBMI lookups
+} t_lutJob;
+
+// The lookups below need AVX-512 VBMI for the 64-lane byte permutes; with any other
+// instruction set the scalar loop is as fast as the shuffles that could replace them
+#if CPU_X86
+
+// Look up 64 bytes in a 256-entry table held in four registers: the low 7 bits
+// index a pair of registers, bit 7 picks the pair
+static inline __attribute__((always_inline)) CPU_TARGET_AVX512VBMI
+__m512i lut_lookup64(__m512i v, const __m512i t[4]) {
+    __m512i low = _mm512_permutex2var_epi8(t[0], v, t[1]);
+    __m512i high = _mm512_permutex2var_epi8(t[2], v, t[3]);
+    return _mm512_mask_blend_epi8(_mm512_movepi8_mask(v), low, high);
+}
+
+// Load a 256-entry table into four registers
+static inline __attribute__((always_inline)) CPU_TARGET_AVX512VBMI
+void lut_loadTable(const uint8_t *table, __m512i t[4]) {
+    for (int j = 0; j < 4; j++) t[j] = _mm512_loadu_si512(table + 64 * j);
+}
+
+// Vector lookup of whole 64-byte blocks through one table. Returns the bytes done.
+static CPU_TARGET_AVX512VBMI int lut_vectorUniform(const uint8_t *table, uint8_t *p, int length) {
+    __m512i t[4];
+    lut_loadTable(table, t);
+    int i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i v = _mm512_loadu_si512(p + i);
+        _mm512_storeu_si512(p + i, lut_lookup64(v, t));
+    }
+    return i;
+}
+
+// Vector lookup of whole 192-byte blocks (64 pixels) of 3-channel samples through
+// one table per channel. Returns the bytes done.
+static CPU_TARGET_AVX512VBMI int lut_vectorRGB(const t_lut *lut, uint8_t *p, int length) {
+    __m512i t[3][4];
+    for (int c = 0; c < 3; c++) lut_loadTable(lut->table[c], t[c]);
+
+    // Lanes of channel 1 and 2 in each of the three vectors of a block
+    __mmask64 masks[3][2];
+    for (int k = 0; k < 3; k++) {
+        masks[k][0] = masks[k][1] = 0;
+        for (int j = 0; j < 64; j++) {
+            int c = (64 * k + j) % 3;
+            if (c > 0) masks[k][c - 1] |= (__mmask64)1 << j;
+        }
+    }
+
+    int i = 0;
+    for (; i + 192 <= length; i += 192) {
+        for (int k = 0; k < 3; k++) {
+            __m512i v = _mm512_loadu_si512(p + i + 64 * k);
+            __m512i out = lut_lookup64(v, t[0]);
+            out = _mm512_mask_blend_epi8(masks[k][0], out, lut_lookup64(v, t[1]));
+            out = _mm512_mask_blend_epi8(masks[k][1], out, lut_lookup64(v, t[2]));
+            _mm512_storeu_si512(p + i + 64 * k, out);
+        }
+    }
+    return i;
+}
+
+#endif
+
+// Table lookup of the rows [y0, y1)
+static void lut_rows(void *context, int y0, int y1) {
+    t_lutJob *job = context;
+    const t_raster *raster = job->raster;
+    const t_lut *lut = job->lut;
+    int channels = raster->channels;
+    int length = raster->width * channels;
+
+    for (int y = y0; y < y1; y++) {
+        uint8_t *p = raster->data + (size_t)y * raster->stride;
+        int done = 0;
+        if (job->uniform) {
+            const uint8_t *table = lut->table[0];
+#if CPU_X86
+            if (job->vbmi) done = lut_vectorUniform(table, p, length);
+#endif
+            for (int i = done; i < length; i++) p[i] = table[p[i]];
+        } else {
+#if CPU_X86
+            if (job->vbmi && channels == 3) done = lut_vectorRGB(lut, p, length);
+#endif
+            for (int i = done; i < length; i += channels) {
+                for (int c = 0; c < channels; c++) p[i + c] = lut->table[c][p[i + c]];
+            }
+        }
+    }
+}
+
+// Run every value of a raster through the table in one pass
+void lut_apply(const t_lut *lut, const t_raster *raster) {
+    if (raster->width <= 0 || raster->height <= 0 || raster->channels > LUT_CHANNELS) return;
+    if (lut_isIdentity(lut)) return;
+
+    t_lutJob job = { .lut = lut, .raster = raster, .vbmi = cpu_hasVbmi() };
+    job.uniform = raster->channels == 1
+                  || (memcmp(lut->table[0], lut->table[1], 256) == 0
+                      && memcmp(lut->table[0], lut->table[2], 256) == 0);
+
+    int rowLength = raster->width * raster->channels;
+    int grain = rowLength >= LUT_BAND_SAMPLES ? 1 : LUT_BAND_SAMPLES / rowLength;
+    pool_parallelFor(raster->height, grain, lut_rows, &job);
+}
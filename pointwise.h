@@ -0,0 +1,51 @@
+#ifndef POINTWISE_H
+#define POINTWISE_H
+#include <stdint.h>
+#include "convolution.h"
+
+// Most channels a lookup table has a separate map for
+#define LUT_CHANNELS 3
+
+// Any sequence of per-value operations, composed into one 256-entry map per channel.
+// Sample c of each pixel goes through table[c]; 1-channel rasters use table[0].
+// Every lut_ operation below is appended after the ones already in the table, so
+// applying the table once gives the same result as applying each operation in turn.
+typedef struct {
+    uint8_t table[LUT_CHANNELS][256];
+} t_lut;
+
+// Function to reset a table to the identity
+void lut_identity(t_lut *lut);
+
+// Function to append an arbitrary map, to every channel or only to channel (0 to 2)
+// when channel >= 0. Equalization maps are appended this way.
+void lut_map(t_lut *lut, int channel, const uint8_t map[256]);
+
+// Function to append a negative: v -> 255 - v
+void lut_negative(t_lut *lut);
+
+// Function to append a brightness change: v -> v + value, clamped to [0, 255]
+void lut_brightness(t_lut *lut, int value);
+
+// Function to append a threshold: v -> 255 if v >= threshold, else 0
+void lut_threshold(t_lut *lut, int threshold);
+
+// Function to append a gamma correction: v -> 255 * (v / 255)^(1 / gamma), rounded.
+// gamma > 1 brightens the mid-tones, gamma < 1 darkens them.
+void lut_gamma(t_lut *lut, float gamma);
+
+// Function to append a levels adjustment: [inBlack, inWhite] is stretched to
+// [outBlack, outWhite] with gamma applied in between, values outside are clamped
+void lut_levels(t_lut *lut, int inBlack, int inWhite, float gamma, int outBlack, int outWhite);
+
+// Function to append the histogram equalization map of a cumulative histogram
+// (cdf[255] counts every value) over total samples, to every channel or only to channel
+void lut_equalize(t_lut *lut, int channel, const unsigned int *cdf, unsigned int total);
+
+// Function to tell whether a table leaves every value unchanged
+int lut_isIdentity(const t_lut *lut);
+
+// Function to run every value of a raster through the table, in place, in one pass
+void lut_apply(const t_lut *lut, const t_raster *raster);
+
+#endif // POINTWISE_H
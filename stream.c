@@ -0,0 +1,424 @@
+#include "stream.h"
+#include "imgfun.h"
+#include "bmp.h"
+#include "bmp24.h"
+#include "histogram.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes of pixels read, processed and written at a time
+#define STREAM_STRIP_BYTES (1 << 20)
+
+// Size of the BMP file and info headers
+#define STREAM_HEADER_SIZE 54
+
+// Largest pixel offset accepted, which bounds the header copied to the output
+#define STREAM_MAX_OFFSET (1 << 16)
+
+// One operation of a running stream
+typedef struct {
+    t_streamOp op;
+    float **kernel;       // STREAM_KERNEL: row pointers
+    uint8_t map[256];     // STREAM_EQUALIZE on 24-bit images: luma map, once counted
+    uint8_t *window;      // STREAM_KERNEL: input rows [base, base + filled), see stream_windowRow
+    uint8_t *out;         // STREAM_KERNEL: output rows, laid out like the window
+    int filled;
+    int base;             // File row held in window row 0 (negative for the zeros before row 0)
+    int next;             // Next output row to compute
+} t_streamStage;
+
+// A BMP file being read and the stages its rows go through
+typedef struct {
+    FILE *in;
+    unsigned char *header;  // Everything before the pixels, copied to the output as is
+    long offset;
+    int width, height, depth, channels;
+    size_t rowBytes;        // Pixels of a row, without padding
+    size_t fileRow;         // Row in the file, padded to 4 bytes
+    int stripRows;
+    uint8_t *strip;         // Rows read from the file
+    t_streamStage *stages;
+    int stageCount;
+    int count;              // Stages the current pass runs
+    int capacity;           // Rows of every window
+    int topDown;            // Loaded images are top-down but the file bottom-up (24 bits):
+                            // windows fill from their end to hold rows in image order
+    FILE *out;              // Output of the last pass, NULL while counting a histogram
+    t_histogram hist;       // Histogram of the rows reaching the end of a counting pass
+    t_imgfunError error;    // Set once a filter or a write fails
+} t_stream;
+
+// Swap the first and third byte of every pixel (BGR <-> RGB) of bytes of rows, in place
+static void stream_swapRedBlue(uint8_t *rows, size_t bytes) {
+    for (size_t i = 0; i + 2 < bytes; i += 3) {
+        uint8_t b = rows[i];
+        rows[i] = rows[i + 2];
+        rows[i + 2] = b;
+    }
+}
+
+// Open a BMP file and read its header. Returns 0 on success.
+static int stream_open(t_stream *s, const char *filename) {
+    s->in = fopen(filename, "rb");
+    if (!s->in) {
+        return imgfun_fail(IMGFUN_ERROR_OPEN, "File doesn't exist: %s", filename);
+    }
+
+    unsigned char header[STREAM_HEADER_SIZE];
+    if (fread(header, 1, STREAM_HEADER_SIZE, s->in) != STREAM_HEADER_SIZE) {
+        return imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+    }
+    int32_t width = (int32_t)bmp_readU32(&header[18]);
+    int32_t height = (int32_t)bmp_readU32(&header[22]);
+    s->offset = bmp_readU32(&header[10]);
+    s->depth = bmp_readU16(&header[28]);
+    if (bmp_readU16(&header[0]) != 0x4D42 || bmp_readU32(&header[30]) != 0
+        || (s->depth != 8 && s->depth != 24)) {
+        return imgfun_fail(IMGFUN_ERROR_FORMAT, "Only uncompressed 8-bit and 24-bit images are supported.");
+    }
+    if (width <= 0 || height <= 0 || s->offset < STREAM_HEADER_SIZE
+        || s->offset > STREAM_MAX_OFFSET) {
+        return imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+    }
+
+    s->width = width;
+    s->height = height;
+    s->channels = s->depth / 8;
+    s->topDown = s->depth == 24;
+    s->rowBytes = (size_t)width * s->channels;
+    s->fileRow = (s->rowBytes + 3) & ~(size_t)3;
+    s->stripRows = s->rowBytes >= STREAM_STRIP_BYTES ? 1 : (int)(STREAM_STRIP_BYTES / s->rowBytes);
+    if (s->stripRows > height) s->stripRows = height;
+
+    s->header = malloc(s->offset);
+    if (!s->header || fseek(s->in, 0, SEEK_SET) != 0
+        || fread(s->header, 1, s->offset, s->in) != (size_t)s->offset) {
+        return imgfun_fail(IMGFUN_ERROR_FORMAT, "Couldn't read BMP header.");
+    }
+    return 0;
+}
+
+// Read the size and color depth of a BMP file from its header only
+int stream_probe(const char *filename, int *width, int *height, int *colorDepth) {
+    t_stream s = {0};
+    int status = stream_open(&s, filename);
+    if (status == 0) {
+        *width = s.width;
+        *height = s.height;
+        *colorDepth = s.depth;
+    }
+    if (s.in) fclose(s.in);
+    free(s.header);
+    return status;
+}
+
+// View count rows of the stream stored in rows as a raster
+static t_raster stream_raster(const t_stream *s, uint8_t *rows, int count) {
+    t_raster raster = { rows, s->width, count, s->channels, s->rowBytes };
+    return raster;
+}
+
+// View count rows of a 24-bit stream stored in rows as an image
+static t_bmp24 stream_image(const t_stream *s, uint8_t *rows, int count) {
+    t_bmp24 img = { .width = s->width, .height = count, .colorDepth = 24,
+                    .pixels = (t_pixel *)rows, .stride = s->width };
+    return img;
+}
+
+// Hand count finished rows to the end of the pass: the output file or the histogram
+static void stream_sink(t_stream *s, uint8_t *rows, int count) {
+    t_raster raster = stream_raster(s, rows, count);
+    if (!s->out) {
+        t_histogram part;
+        hist_compute(&raster, &part);
+        for (int v = 0; v < 256; v++) {
+            s->hist.channel[0][v] += part.channel[0][v];
+            s->hist.luma[v] += part.luma[v];
+        }
+        return;
+    }
+
+    static const uint8_t padding[3] = {0};
+    size_t pad = s->fileRow - s->rowBytes;
+    if (s->depth == 24) stream_swapRedBlue(rows, count * s->rowBytes);
+    for (int y = 0; y < count; y++) {
+        if (fwrite(rows + y * s->rowBytes, 1, s->rowBytes, s->out) != s->rowBytes
+            || fwrite(padding, 1, pad, s->out) != pad) {
+            s->error = IMGFUN_ERROR_WRITE;
+            return;
+        }
+    }
+    trace_count(TRACE_BYTES_WRITTEN, count * s->fileRow);
+}
+
+static void stream_push(t_stream *s, int first, uint8_t *rows, int count);
+
+// Place of window row j (file row base + j) in a window or output buffer. Top-down
+// streams store it counting from the end, so the rows held are in image order and
+// kernels see them as conv_apply sees the loaded image.
+static size_t stream_windowRow(const t_stream *s, int j) {
+    return (size_t)(s->topDown ? s->capacity - 1 - j : j) * s->rowBytes;
+}
+
+// Reverse the order of count rows in place
+static void stream_reverseRows(const t_stream *s, uint8_t *rows, int count) {
+    for (int a = 0, b = count - 1; a < b; a++, b--) {
+        uint8_t *p = rows + a * s->rowBytes, *q = rows + b * s->rowBytes;
+        for (size_t k = 0; k < s->rowBytes; k++) {
+            uint8_t t = p[k];
+            p[k] = q[k];
+            q[k] = t;
+        }
+    }
+}
+
+// Convolve every row whose neighbors have all arrived, pass them on and
+// drop the input rows no output needs any more
+static void stream_convolve(t_stream *s, int i) {
+    t_streamStage *stage = &s->stages[i];
+    int n = stage->op.kernelSize / 2;
+    int ready = stage->base + stage->filled - n - stage->next;
+    if (stage->next + ready > s->height) ready = s->height - stage->next;
+    if (ready <= 0) return;
+
+    // Window rows are file rows shifted by base, and the rows before and after the
+    // image are held as zeros, so no tap ever falls outside the window
+    int y0 = stage->next - stage->base;
+    size_t first = s->topDown ? stream_windowRow(s, stage->filled - 1) : 0;
+    int r0 = s->topDown ? stage->filled - y0 - ready : y0;
+    t_raster src = stream_raster(s, stage->window + first, stage->filled);
+    t_raster dst = stream_raster(s, stage->out + first, stage->filled);
+    if (conv_applyRows(&src, &dst, stage->kernel, stage->op.kernelSize,
+                       s->depth == 8 ? CONV_ROUND : CONV_TRUNCATE, CONV_EDGE_ZERO,
+                       r0, r0 + ready) != 0) {
+        s->error = IMGFUN_ERROR_MEMORY;
+    }
+    stage->next += ready;
+    uint8_t *out = stage->out + first + r0 * s->rowBytes;
+    if (s->topDown) stream_reverseRows(s, out, ready);
+    stream_push(s, i + 1, out, ready);
+
+    int drop = stage->next - n - stage->base;
+    int keep = stage->filled - drop;
+    memmove(stage->window + stream_windowRow(s, s->topDown ? keep - 1 : 0),
+            stage->window + stream_windowRow(s, s->topDown ? stage->filled - 1 : drop),
+            keep * s->rowBytes);
+    stage->filled = keep;
+    stage->base += drop;
+}
+
+// Append count rows (or zero rows when rows is NULL) to the window of a convolution
+static void stream_feed(t_stream *s, int i, const uint8_t *rows, int count) {
+    t_streamStage *stage = &s->stages[i];
+    while (count > 0) {
+        int take = s->capacity - stage->filled;
+        if (take > count) take = count;
+        for (int r = 0; r < take; r++) {
+            uint8_t *row = stage->window + stream_windowRow(s, stage->filled + r);
+            if (rows) memcpy(row, rows + r * s->rowBytes, s->rowBytes);
+            else memset(row, 0, s->rowBytes);
+        }
+        if (rows) rows += take * s->rowBytes;
+        stage->filled += take;
+        count -= take;
+        stream_convolve(s, i);
+    }
+}
+
+// Run count rows through the stages from first on
+static void stream_push(t_stream *s, int first, uint8_t *rows, int count) {
+    for (int i = first; i < s->count; i++) {
+        t_streamStage *stage = &s->stages[i];
+        t_raster raster = stream_raster(s, rows, count);
+        t_bmp24 img = stream_image(s, rows, count);
+        switch (stage->op.kind) {
+            case STREAM_LUT:
+                lut_apply(&stage->op.lut, &raster);
+                break;
+            case STREAM_GRAYSCALE:
+                bmp24_grayscale(&img);
+                break;
+            case STREAM_EQUALIZE:
+                if (s->depth == 8) lut_apply(&stage->op.lut, &raster);
+                else bmp24_remapLuma(&img, stage->map);
+                break;
+            case STREAM_KERNEL:
+                // The rest of the chain runs as rows come out of the convolution
+                stream_feed(s, i, rows, count);
+                return;
+        }
+    }
+    stream_sink(s, rows, count);
+}
+
+// Run every row of the input through the first count stages
+static int stream_pass(t_stream *s, int count) {
+    s->count = count;
+    for (int i = 0; i < count; i++) {
+        t_streamStage *stage = &s->stages[i];
+        if (stage->op.kind != STREAM_KERNEL) continue;
+        // The rows before the image are zeros
+        int n = stage->op.kernelSize / 2;
+        stage->filled = 0;
+        stage->base = -n;
+        stage->next = 0;
+        stream_feed(s, i, NULL, n);
+    }
+    if (fseek(s->in, s->offset, SEEK_SET) != 0) {
+        return imgfun_fail(IMGFUN_ERROR_READ, "Pixel read failed.");
+    }
+
+    size_t pad = s->fileRow - s->rowBytes;
+    uint8_t padding[3];
+    for (int y = 0; y < s->height; y += s->stripRows) {
+        int rows = s->height - y < s->stripRows ? s->height - y : s->stripRows;
+        for (int r = 0; r < rows; r++) {
+            if (fread(s->strip + r * s->rowBytes, 1, s->rowBytes, s->in) != s->rowBytes) {
+                return imgfun_fail(IMGFUN_ERROR_READ, "Pixel read failed.");
+            }
+            // The last row of a 24-bit file may omit its padding, as bmp24_loadImage accepts
+            int last = s->depth == 24 && y + r == s->height - 1;
+            if (!last && fread(padding, 1, pad, s->in) != pad) {
+                return imgfun_fail(IMGFUN_ERROR_READ, "Pixel read failed.");
+            }
+        }
+        trace_count(TRACE_BYTES_READ, rows * s->fileRow);
+        if (s->depth == 24) stream_swapRedBlue(s->strip, rows * s->rowBytes);
+        stream_push(s, 0, s->strip, rows);
+    }
+
+    // The rows after the image are zeros: they push out the last rows of each convolution
+    for (int i = 0; i < count; i++) {
+        if (s->stages[i].op.kind == STREAM_KERNEL) {
+            stream_feed(s, i, NULL, s->stages[i].op.kernelSize / 2);
+        }
+    }
+    return 0;
+}
+
+// Set up the stages of every operation. Returns 0 on success.
+static int stream_prepare(t_stream *s, const t_streamOp *ops, int count) {
+    int largest = 1;
+    for (int i = 0; i < count; i++) {
+        if (ops[i].kind == STREAM_GRAYSCALE && s->depth != 24) {
+            return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Grayscale only works on 24-bit images.");
+        }
+        if (ops[i].kind == STREAM_KERNEL) {
+            if (ops[i].kernelSize < 1 || ops[i].kernelSize % 2 == 0) {
+                return imgfun_fail(IMGFUN_ERROR_ARGUMENT, "Unsupported kernel size.");
+            }
+            if (ops[i].kernelSize > largest) largest = ops[i].kernelSize;
+        }
+    }
+    // A strip, and the rows each side of it the largest kernel needs
+    s->capacity = s->stripRows + largest - 1;
+
+    s->strip = malloc(s->stripRows * s->rowBytes);
+    s->stages = calloc(count > 0 ? count : 1, sizeof(t_streamStage));
+    if (!s->strip || !s->stages) return imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
+    s->stageCount = count;
+
+    for (int i = 0; i < count; i++) {
+        t_streamStage *stage = &s->stages[i];
+        stage->op = ops[i];
+        if (ops[i].kind != STREAM_KERNEL) continue;
+
+        int size = ops[i].kernelSize;
+        stage->kernel = malloc(size * sizeof(float *));
+        stage->window = malloc(s->capacity * s->rowBytes);
+        stage->out = malloc(s->capacity * s->rowBytes);
+        if (!stage->kernel || !stage->window || !stage->out) {
+            return imgfun_fail(IMGFUN_ERROR_MEMORY, "Memory allocation failed.");
+        }
+        for (int r = 0; r < size; r++) stage->kernel[r] = (float *)ops[i].kernel + r * size;
+    }
+    return 0;
+}
+
+// Free everything a stream holds except the output file
+static void stream_close(t_stream *s) {
+    if (s->in) fclose(s->in);
+    for (int i = 0; s->stages && i < s->stageCount; i++) {
+        free(s->stages[i].kernel);
+        free(s->stages[i].window);
+        free(s->stages[i].out);
+    }
+    free(s->stages);
+    free(s->strip);
+    free(s->header);
+}
+
+// Count the histogram of the rows reaching equalization i and turn it into its map
+static int stream_count(t_stream *s, int i) {
+    memset(&s->hist, 0, sizeof(s->hist));
+    int status = stream_pass(s, i);
+    if (status != 0) return status;
+    if (s->error) {
+        return imgfun_fail(IMGFUN_ERROR_MEMORY, "Filter failed.");
+    }
+
+    t_streamStage *stage = &s->stages[i];
+    unsigned int total = (unsigned int)s->width * s->height;
+    if (s->depth == 8) {
+        unsigned int cdf[256];
+        hist_cumulate(s->hist.channel[0], cdf);
+        lut_identity(&stage->op.lut);
+        lut_equalize(&stage->op.lut, -1, cdf, total);
+    } else {
+        bmp24_equalizationMap(s->hist.luma, total, stage->map);
+    }
+    return 0;
+}
+
+// Run the operations from input to output
+static int stream_run(const char *input, const char *output, const t_streamOp *ops, int count) {
+    t_stream s = {0};
+    int status = stream_open(&s, input);
+    if (status == 0) status = stream_prepare(&s, ops, count);
+
+    // Every equalization needs the histogram of its input before its first row
+    for (int i = 0; i < count && status == 0; i++) {
+        if (ops[i].kind == STREAM_EQUALIZE) status = stream_count(&s, i);
+    }
+    if (status != 0) {
+        stream_close(&s);
+        return status;
+    }
+
+    // The input may be the output: write a new file and rename it at the end
+    char *path = malloc(strlen(output) + 5);
+    if (path) {
+        strcpy(path, output);
+        strcat(path, ".tmp");
+        s.out = fopen(path, "wb");
+    }
+    if (!s.out) {
+        free(path);
+        stream_close(&s);
+        return imgfun_fail(IMGFUN_ERROR_WRITE, "Save error (no spaces in name): %s", output);
+    }
+
+    status = fwrite(s.header, 1, s.offset, s.out) == (size_t)s.offset ? 0 : IMGFUN_ERROR_WRITE;
+    if (status == 0) status = stream_pass(&s, count);
+    if (status == 0) status = s.error;
+    if (fclose(s.out) != 0 && status == 0) status = IMGFUN_ERROR_WRITE;
+    if (status == 0 && rename(path, output) != 0) status = IMGFUN_ERROR_WRITE;
+    if (status != 0) remove(path);
+    if (status == IMGFUN_ERROR_MEMORY) imgfun_fail(status, "Filter failed.");
+    if (status == IMGFUN_ERROR_WRITE) imgfun_fail(status, "Save error: %s", output);
+    if (status == 0) trace_count(TRACE_PIXELS, (unsigned long long)s.width * s.height);
+    free(path);
+    stream_close(&s);
+    return status;
+}
+
+// Run operations over a BMP file into another one a strip at a time
+int stream_process(const char *input, const char *output, const t_streamOp *ops, int count) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int status = stream_run(input, output, ops, count);
+    trace_end(&span, __func__, 0);
+    return status;
+}
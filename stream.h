@@ -0,0 +1,34 @@
+#ifndef STREAM_H
+#define STREAM_H
+#include "pointwise.h"
+
+// Operations a stream can run
+typedef enum {
+    STREAM_LUT,        // Lookup table on every sample (negative, brightness, threshold, ...)
+    STREAM_GRAYSCALE,  // Average of the three colors (24-bit images only)
+    STREAM_KERNEL,     // Square convolution kernel, pixels outside the image count as 0
+    STREAM_EQUALIZE    // Histogram equalization (of the luma for 24-bit images)
+} t_streamKind;
+
+// One operation of a stream
+typedef struct {
+    t_streamKind kind;
+    t_lut lut;            // STREAM_LUT, tables in red, green, blue order
+    const float *kernel;  // STREAM_KERNEL: kernelSize * kernelSize weights, row by row
+    int kernelSize;       // STREAM_KERNEL: odd width and height of the kernel
+} t_streamOp;
+
+// Function to read the size and color depth of a BMP file from its header only.
+// Returns 0, or an IMGFUN_ERROR_ code if it isn't an uncompressed 8-bit or 24-bit BMP.
+int stream_probe(const char *filename, int *width, int *height, int *colorDepth);
+
+// Function to run operations over a BMP file into another one without loading either:
+// rows are read a strip at a time, pointwise operations run on the strip, every
+// convolution keeps only the kernelSize - 1 rows it still needs around the current
+// strip, and finished rows are written out at once. Memory grows with the width and
+// the kernel sizes, never with the height. Each equalization first reads the input once
+// more to count its histogram. The result is the one the in-memory filters give.
+// Returns 0 or an IMGFUN_ERROR_ code (IMGFUN_ERROR_WRITE when the output couldn't be written).
+int stream_process(const char *input, const char *output, const t_streamOp *ops, int count);
+
+#endif // STREAM_H
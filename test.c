@@ -0,0 +1,1055 @@
+#include "imgfun.h"
+#include "histogram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+// Directory of the bundled images, set by CMake
+#ifndef IMGFUN_TEST_IMAGES
+#define IMGFUN_TEST_IMAGES "."
+#endif
+
+// Longest path the test builds
+#define TEST_MAX_PATH 4096
+
+// Threads of the threaded variants: an odd count, so the bands differ in size
+#define TEST_THREADS 3
+
+// Level of the variants that run with the best instruction set of the CPU
+#define TEST_BEST (-1)
+
+// Tile side and clip limit of the CLAHE checked
+#define TEST_CLAHE_TILE HIST_MIN_TILE
+#define TEST_CLAHE_CLIP 2.0f
+
+// Added by the double precision references before rounding
+#define TEST_EPSILON 1e-7
+
+// Bundled images checked before the random ones
+static const char *test_bundled[] = {
+    "lena_gray.bmp", "barbara_gray.bmp", "lena_color.bmp", "flowers_color.bmp"
+};
+
+// Width and height of the flat images, all black then all mid-gray, each at both depths
+static const int test_flatSize[2] = { 37, 23 };
+static const int test_flatLevels[] = { 0, 128 };
+
+// Width and height of the random images, each made at both depths. Most widths are odd
+// and fall on either side of the vector widths; the last ones are big enough to be
+// split into bands by the threads and into strips in place.
+static const int test_sizes[][2] = {
+    { 1, 1 }, { 2, 3 }, { 3, 7 }, { 5, 2 }, { 13, 9 }, { 31, 17 }, { 63, 5 }, { 64, 11 },
+    { 65, 33 }, { 127, 19 }, { 257, 63 }, { 1001, 131 }, { 1531, 717 }
+};
+
+// 5x5 kernel that is neither separable nor a fraction with a small divisor, so it
+// takes the general 2D float path
+static const float test_kernel5[25] = {
+    0.011f, 0.023f, 0.031f, 0.019f, 0.007f,
+    0.021f, 0.053f, 0.071f, 0.047f, 0.017f,
+    0.029f, 0.067f, 0.173f, 0.061f, 0.033f,
+    0.013f, 0.049f, 0.073f, 0.051f, 0.027f,
+    0.003f, 0.017f, 0.037f, 0.023f, 0.009f,
+};
+
+// Operation checked, the color depths it exists for (0 for both), the largest
+// difference allowed from its reference in any sample, how to run it once and how to
+// compute the reference (both return 0 or an IMGFUN_ERROR_ code). Operations with a
+// stream form also get that variant.
+typedef struct {
+    const char *name;
+    int depths;
+    int tolerance;
+    int (*run)(t_bmp *img);
+    int (*reference)(t_bmp *img);
+    int stream;               // t_streamKind of the stream form, -1 when there is none
+    void (*lut)(t_lut *lut);  // STREAM_LUT: appends the table of the operation
+    const float *kernel;      // STREAM_KERNEL: kernelSize * kernelSize weights, row by row
+    int kernelSize;
+} t_testOp;
+
+// How a variant computes the result
+typedef enum {
+    TEST_LIBRARY,  // Runs the operation on the loaded image
+    TEST_STREAM    // Runs the stream form from file to file
+} t_testMode;
+
+// One way of computing the result of an operation, compared with the reference
+typedef struct {
+    const char *name;
+    t_testMode mode;
+    int level;     // t_cpuLevel, or TEST_BEST; skipped when the CPU doesn't support it
+    int threads;
+    int inPlace;   // Kernel filters write back into the image
+    int palette;   // 8-bit pointwise operations only rewrite the palette
+} t_testVariant;
+
+// Every variant must also give exactly the result of the first one, the scalar kernels
+// on one thread
+static const t_testVariant test_variants[] = {
+    { "scalar", TEST_LIBRARY, CPU_SCALAR, 1, 0, 0 },
+    { "sse4.2", TEST_LIBRARY, CPU_SSE42, 1, 0, 0 },
+    { "avx2", TEST_LIBRARY, CPU_AVX2, 1, 0, 0 },
+    { "avx512", TEST_LIBRARY, CPU_AVX512, 1, 0, 0 },
+    { "scalar-threads", TEST_LIBRARY, CPU_SCALAR, TEST_THREADS, 0, 0 },
+    { "threads", TEST_LIBRARY, TEST_BEST, TEST_THREADS, 0, 0 },
+    { "in-place", TEST_LIBRARY, TEST_BEST, TEST_THREADS, 1, 0 },
+    { "palette", TEST_LIBRARY, TEST_BEST, 1, 0, 1 },
+    { "stream", TEST_STREAM, TEST_BEST, TEST_THREADS, 0, 0 },
+};
+
+// Settings given on the command line
+typedef struct {
+    const char *images;  // Directory of the bundled images
+    const char *only;    // Only check the operations whose name contains this, NULL for all
+    unsigned int seed;   // Seed of the random images
+    int verbose;         // Print the difference of every variant
+} t_testSettings;
+
+// Files of one image under test
+typedef struct {
+    const char *name;
+    const char *input;   // The image
+    const char *output;  // Scratch file the stream variant writes
+} t_testImage;
+
+// Comparisons made and failed so far
+typedef struct {
+    int compared;
+    int failed;
+} t_testCounts;
+
+// Width and height of a loaded image
+static void test_size(const t_bmp *img, int *width, int *height) {
+    if (img->colorDepth == 8) {
+        *width = (int)img->img8->width;
+        *height = (int)img->img8->height;
+    } else {
+        *width = img->img24->width;
+        *height = img->img24->height;
+    }
+}
+
+// Samples of row y of a loaded image (bottom-up for 8 bits, top-down for 24 bits,
+// the same for both images compared)
+static const uint8_t *test_row(const t_bmp *img, int y) {
+    if (img->colorDepth == 8) {
+        size_t stride = (img->img8->width + 3) & ~3u;
+        return img->img8->data + (size_t)y * stride;
+    }
+    return (const uint8_t *)bmp24_row(img->img24, y);
+}
+
+static int test_negative(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_negative(img->img8);
+    return bmp24_negative(img->img24);
+}
+
+static int test_brightness(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_brightness(img->img8, 40);
+    return bmp24_brightness(img->img24, 40);
+}
+
+static void test_lutBrightness(t_lut *lut) {
+    lut_brightness(lut, 40);
+}
+
+static int test_darken(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_brightness(img->img8, -70);
+    return bmp24_brightness(img->img24, -70);
+}
+
+static void test_lutDarken(t_lut *lut) {
+    lut_brightness(lut, -70);
+}
+
+static int test_threshold(t_bmp *img) {
+    return bmp8_threshold(img->img8, 128);
+}
+
+static void test_lutThreshold(t_lut *lut) {
+    lut_threshold(lut, 128);
+}
+
+static int test_grayscale(t_bmp *img) {
+    return bmp24_grayscale(img->img24);
+}
+
+static int test_boxBlur(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_boxBlur(img->img8);
+    return bmp24_boxBlur(img->img24);
+}
+
+static int test_gaussian(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_gaussianBlur(img->img8);
+    return bmp24_gaussianBlur(img->img24);
+}
+
+static int test_outline(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_outline(img->img8);
+    return bmp24_outline(img->img24);
+}
+
+static int test_emboss(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_emboss(img->img8);
+    return bmp24_emboss(img->img24);
+}
+
+static int test_sharpen(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_sharpen(img->img8);
+    return bmp24_sharpen(img->img24);
+}
+
+// Box blur of radius 7, the running sum path, with mirrored edges
+static int test_boxBlur15(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_boxBlurRadius(img->img8, 7, CONV_EDGE_MIRROR);
+    return bmp24_boxBlurRadius(img->img24, 7, CONV_EDGE_MIRROR);
+}
+
+// Gaussian blur of sigma 2.5, an exact kernel, with clamped edges
+static int test_gaussianSigma(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_gaussianBlurSigma(img->img8, 2.5f, CONV_EDGE_CLAMP);
+    return bmp24_gaussianBlurSigma(img->img24, 2.5f, CONV_EDGE_CLAMP);
+}
+
+// Gaussian blur of sigma 8, three stacked box blurs, with mirrored edges
+static int test_gaussianSigma8(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_gaussianBlurSigma(img->img8, 8.0f, CONV_EDGE_MIRROR);
+    return bmp24_gaussianBlurSigma(img->img24, 8.0f, CONV_EDGE_MIRROR);
+}
+
+// 7-tap binomial blur given as two 1D kernels, the separable float path, wrapping around
+static int test_separable7(t_bmp *img) {
+    static const float taps[7] = { 1 / 64.0f, 6 / 64.0f, 15 / 64.0f, 20 / 64.0f, 15 / 64.0f, 6 / 64.0f,
+                                   1 / 64.0f };
+    if (img->colorDepth == 8) return bmp8_applySeparableFilter(img->img8, taps, taps, 7, CONV_EDGE_WRAP);
+    return bmp24_applySeparableFilter(img->img24, taps, taps, 7, CONV_EDGE_WRAP);
+}
+
+// 5x5 kernel through the general 2D float path
+static int test_kernel5x5(t_bmp *img) {
+    float rows[5][5];
+    float *kernel[5];
+    for (int i = 0; i < 5; i++) {
+        memcpy(rows[i], test_kernel5 + 5 * i, sizeof(rows[i]));
+        kernel[i] = rows[i];
+    }
+    if (img->colorDepth == 8) return bmp8_applyFilter(img->img8, kernel, 5);
+    return bmp24_applyFilter(img->img24, kernel, 5);
+}
+
+// Histogram, cumulative histogram and remapping, as the menus and the command line run it
+static int test_equalize(t_bmp *img) {
+    if (img->colorDepth == 24) return bmp24_equalize(img->img24);
+    unsigned int *hist = bmp8_computeHistogram(img->img8);
+    unsigned int *cdf = hist ? bmp8_computeCDF(hist) : NULL;
+    int status = cdf ? bmp8_equalize(img->img8, cdf) : IMGFUN_ERROR_MEMORY;
+    free(hist);
+    free(cdf);
+    return status;
+}
+
+static int test_clahe(t_bmp *img) {
+    if (img->colorDepth == 8) return bmp8_clahe(img->img8, TEST_CLAHE_TILE, TEST_CLAHE_CLIP);
+    return bmp24_clahe(img->img24, TEST_CLAHE_TILE, TEST_CLAHE_CLIP);
+}
+
+// The references below are the operations as first written, before any of them was
+// optimized, on a copy of the samples packed row after row. Operations added since
+// get a plain implementation of what their documentation promises instead.
+
+// Copy the samples of an image into one buffer, row after row without padding.
+// Returns NULL when out of memory.
+static uint8_t *test_pack(const t_bmp *img) {
+    int width, height;
+    test_size(img, &width, &height);
+    size_t rowBytes = (size_t)width * (img->colorDepth / 8);
+    uint8_t *samples = malloc(rowBytes * height + 1);
+    if (!samples) return NULL;
+    for (int y = 0; y < height; y++) memcpy(samples + y * rowBytes, test_row(img, y), rowBytes);
+    return samples;
+}
+
+// Copy packed samples back into an image
+static void test_unpack(t_bmp *img, const uint8_t *samples) {
+    int width, height;
+    test_size(img, &width, &height);
+    size_t rowBytes = (size_t)width * (img->colorDepth / 8);
+    for (int y = 0; y < height; y++) memcpy((uint8_t *)test_row(img, y), samples + y * rowBytes, rowBytes);
+}
+
+static int test_originalNegative(t_bmp *img) {
+    int width, height;
+    test_size(img, &width, &height);
+    for (int y = 0; y < height; y++) {
+        uint8_t *p = (uint8_t *)test_row(img, y);
+        for (int i = 0; i < width * (img->colorDepth / 8); i++) p[i] = 255 - p[i];
+    }
+    return 0;
+}
+
+// bmp8_brightness clamped an int, bmp24_brightness went through fminf and fmaxf
+static int test_originalBrightness(t_bmp *img, int value) {
+    int width, height;
+    test_size(img, &width, &height);
+    for (int y = 0; y < height; y++) {
+        uint8_t *p = (uint8_t *)test_row(img, y);
+        for (int i = 0; i < width * (img->colorDepth / 8); i++) {
+            if (img->colorDepth == 24) {
+                p[i] = fminf(fmaxf(p[i] + value, 0), 255);
+                continue;
+            }
+            int temp = p[i] + value;
+            p[i] = (temp > 255) ? 255 : (temp < 0 ? 0 : (unsigned char)temp);
+        }
+    }
+    return 0;
+}
+
+static int test_originalBrighten(t_bmp *img) {
+    return test_originalBrightness(img, 40);
+}
+
+static int test_originalDarken(t_bmp *img) {
+    return test_originalBrightness(img, -70);
+}
+
+static int test_originalThreshold(t_bmp *img) {
+    int width, height;
+    test_size(img, &width, &height);
+    for (int y = 0; y < height; y++) {
+        uint8_t *p = (uint8_t *)test_row(img, y);
+        for (int x = 0; x < width; x++) p[x] = (p[x] >= 128) ? 255 : 0;
+    }
+    return 0;
+}
+
+static int test_originalGrayscale(t_bmp *img) {
+    for (int y = 0; y < img->img24->height; y++) {
+        t_pixel *p = bmp24_row(img->img24, y);
+        for (int x = 0; x < img->img24->width; x++) {
+            uint8_t g = (p[x].red + p[x].green + p[x].blue) / 3;
+            p[x].red = p[x].green = p[x].blue = g;
+        }
+    }
+    return 0;
+}
+
+// The original per-pixel 24-bit convolution: taps outside the image skipped, truncated
+static t_pixel test_originalConvolution(const t_pixel *pixels, int width, int height, int x, int y,
+                                        const float *kernel, int kernelSize) {
+    int n = kernelSize / 2;
+    float r = 0, g = 0, b = 0;
+
+    for (int ky = -n; ky <= n; ky++) {
+        for (int kx = -n; kx <= n; kx++) {
+            int px = x + kx;
+            int py = y + ky;
+            if (px >= 0 && px < width && py >= 0 && py < height) {
+                t_pixel p = pixels[py * width + px];
+                float coeff = kernel[(ky + n) * kernelSize + kx + n];
+                r += p.red * coeff;
+                g += p.green * coeff;
+                b += p.blue * coeff;
+            }
+        }
+    }
+
+    t_pixel result;
+    result.red = (uint8_t)fminf(fmaxf(r, 0), 255);
+    result.green = (uint8_t)fminf(fmaxf(g, 0), 255);
+    result.blue = (uint8_t)fminf(fmaxf(b, 0), 255);
+    return result;
+}
+
+// bmp8_applyFilter, and bmp24_applyFilter over test_originalConvolution
+static int test_originalFilter(t_bmp *img, const float *kernel, int kernelSize) {
+    int width, height;
+    test_size(img, &width, &height);
+    uint8_t *data = test_pack(img);
+    uint8_t *newData = test_pack(img);
+    if (!data || !newData) {
+        free(data);
+        free(newData);
+        return IMGFUN_ERROR_MEMORY;
+    }
+
+    int n = kernelSize / 2;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (img->colorDepth == 24) {
+                ((t_pixel *)newData)[y * width + x] = test_originalConvolution(
+                    (const t_pixel *)data, width, height, x, y, kernel, kernelSize);
+                continue;
+            }
+            float pixel = 0.0f;
+            for (int ky = -n; ky <= n; ky++) {
+                for (int kx = -n; kx <= n; kx++) {
+                    int ix = x + kx;
+                    int iy = y + ky;
+                    if (ix >= 0 && ix < width && iy >= 0 && iy < height) {
+                        pixel += data[iy * width + ix] * kernel[(ky + n) * kernelSize + kx + n];
+                    }
+                }
+            }
+            if (pixel < 0) pixel = 0;
+            if (pixel > 255) pixel = 255;
+            newData[y * width + x] = (unsigned char)roundf(pixel);
+        }
+    }
+    test_unpack(img, newData);
+    free(data);
+    free(newData);
+    return 0;
+}
+
+static int test_originalBoxBlur(t_bmp *img) {
+    return test_originalFilter(img, conv_stockKernels[CONV_STOCK_BOX], CONV_STOCK_SIZE);
+}
+
+static int test_originalGaussian(t_bmp *img) {
+    return test_originalFilter(img, conv_stockKernels[CONV_STOCK_GAUSSIAN], CONV_STOCK_SIZE);
+}
+
+static int test_originalOutline(t_bmp *img) {
+    return test_originalFilter(img, conv_stockKernels[CONV_STOCK_OUTLINE], CONV_STOCK_SIZE);
+}
+
+static int test_originalEmboss(t_bmp *img) {
+    return test_originalFilter(img, conv_stockKernels[CONV_STOCK_EMBOSS], CONV_STOCK_SIZE);
+}
+
+static int test_originalSharpen(t_bmp *img) {
+    return test_originalFilter(img, conv_stockKernels[CONV_STOCK_SHARPEN], CONV_STOCK_SIZE);
+}
+
+static int test_originalKernel5x5(t_bmp *img) {
+    return test_originalFilter(img, test_kernel5, 5);
+}
+
+// Position read for coordinate i of an axis of size samples, or -1 for a zero tap
+static int test_edge(int i, int size, t_convEdge edge) {
+    if (i >= 0 && i < size) return i;
+    switch (edge) {
+        case CONV_EDGE_CLAMP:
+            return i < 0 ? 0 : size - 1;
+        case CONV_EDGE_MIRROR:
+            // Reflect around the edge pixel until inside
+            while (i < 0 || i >= size) {
+                if (size == 1) return 0;
+                i = i < 0 ? -i : 2 * (size - 1) - i;
+            }
+            return i;
+        case CONV_EDGE_WRAP:
+            return ((i % size) + size) % size;
+        default:
+            return -1;
+    }
+}
+
+// Separable kernel of 2 * radius + 1 taps applied down then across in double precision,
+// rounded (8 bits) or truncated (24 bits) once at the end. TEST_EPSILON keeps exact
+// whole and half values, like the box means, from falling just below.
+static int test_referenceSeparable(t_bmp *img, const double *taps, int radius, t_convEdge edge) {
+    int width, height;
+    test_size(img, &width, &height);
+    int channels = img->colorDepth / 8;
+    int rowSamples = width * channels;
+    uint8_t *data = test_pack(img);
+    double *column = malloc((size_t)rowSamples * height * sizeof(double));
+    if (!data || !column) {
+        free(data);
+        free(column);
+        return IMGFUN_ERROR_MEMORY;
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int i = 0; i < rowSamples; i++) {
+            double sum = 0;
+            for (int k = -radius; k <= radius; k++) {
+                int from = test_edge(y + k, height, edge);
+                if (from >= 0) sum += taps[k + radius] * data[(size_t)from * rowSamples + i];
+            }
+            column[(size_t)y * rowSamples + i] = sum;
+        }
+    }
+    for (int y = 0; y < height; y++) {
+        uint8_t *out = (uint8_t *)test_row(img, y);
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < channels; c++) {
+                double sum = 0;
+                for (int k = -radius; k <= radius; k++) {
+                    int from = test_edge(x + k, width, edge);
+                    if (from >= 0) {
+                        sum += taps[k + radius] * column[(size_t)y * rowSamples + from * channels + c];
+                    }
+                }
+                sum = fmin(fmax(sum, 0), 255);
+                out[x * channels + c] = (uint8_t)floor(sum + TEST_EPSILON + (channels == 1 ? 0.5 : 0));
+            }
+        }
+    }
+    free(data);
+    free(column);
+    return 0;
+}
+
+// Mean of the 15x15 pixels around each one
+static int test_referenceBoxBlur15(t_bmp *img) {
+    double taps[15];
+    for (int i = 0; i < 15; i++) taps[i] = 1.0 / 15;
+    return test_referenceSeparable(img, taps, 7, CONV_EDGE_MIRROR);
+}
+
+// Gaussian of standard deviation sigma, cut only at 4 sigma where what is left is
+// below a hundredth of a level
+static int test_referenceGaussian(t_bmp *img, double sigma, t_convEdge edge) {
+    int radius = (int)ceil(4 * sigma);
+    double *taps = malloc((2 * radius + 1) * sizeof(double));
+    if (!taps) return IMGFUN_ERROR_MEMORY;
+    double total = 0;
+    for (int i = -radius; i <= radius; i++) total += taps[i + radius] = exp(-i * i / (2 * sigma * sigma));
+    for (int i = 0; i < 2 * radius + 1; i++) taps[i] /= total;
+    int status = test_referenceSeparable(img, taps, radius, edge);
+    free(taps);
+    return status;
+}
+
+static int test_referenceGaussian25(t_bmp *img) {
+    return test_referenceGaussian(img, 2.5, CONV_EDGE_CLAMP);
+}
+
+static int test_referenceGaussian8(t_bmp *img) {
+    return test_referenceGaussian(img, 8.0, CONV_EDGE_MIRROR);
+}
+
+static int test_referenceSeparable7(t_bmp *img) {
+    static const double taps[7] = { 1 / 64.0, 6 / 64.0, 15 / 64.0, 20 / 64.0, 15 / 64.0, 6 / 64.0,
+                                    1 / 64.0 };
+    return test_referenceSeparable(img, taps, 3, CONV_EDGE_WRAP);
+}
+
+// computeEqualizationLUT, which bmp24.c first had: equalization map of a histogram of
+// total values. A single value, where it divided by 0, is left as it is.
+static void test_originalEqualizationLUT(const unsigned int *hist, unsigned int total, uint8_t *lut) {
+    unsigned int cdf[256];
+    hist_cumulate(hist, cdf);
+
+    unsigned int cdf_min = 0;
+    for (int i = 0; i < 256; i++) {
+        if (cdf[i] != 0) {
+            cdf_min = cdf[i];
+            break;
+        }
+    }
+
+    for (int i = 0; i < 256; i++) {
+        if (total == cdf_min) lut[i] = (uint8_t)i;
+        else if (cdf[i] < cdf_min) lut[i] = 0;
+        else lut[i] = (uint8_t)roundf(((float)(cdf[i] - cdf_min) / (total - cdf_min)) * 255);
+    }
+}
+
+// Global equalization of a plane of luma. bmp8_equalize mapped the first value present
+// to 0, bmp24_equalize only mapped 0 there.
+static int test_equalizePlane(uint8_t *plane, int width, int height, int colorDepth) {
+    unsigned int size = (unsigned int)width * height;
+    unsigned int hist[256] = {0};
+    uint8_t map[256];
+    for (unsigned int i = 0; i < size; i++) hist[plane[i]]++;
+    if (colorDepth == 8) {
+        test_originalEqualizationLUT(hist, size, map);
+    } else {
+        unsigned int cdf[256];
+        hist_cumulate(hist, cdf);
+        for (int i = 0; i < 256; i++) {
+            map[i] = size == cdf[0] ? (uint8_t)i
+                     : (uint8_t)roundf(((float)(cdf[i] - cdf[0]) / (size - cdf[0])) * 255.0f);
+        }
+    }
+    for (unsigned int i = 0; i < size; i++) plane[i] = map[plane[i]];
+    return 0;
+}
+
+// CLAHE of a plane of luma: every TEST_CLAHE_TILE square gets the equalization map of
+// its histogram clipped at TEST_CLAHE_CLIP times the mean count, the excess spread
+// over all the values and the remainder every 256 / remainder values (as OpenCV does),
+// and each pixel blends the maps of the four nearest tile centers bilinearly
+static int test_clahePlane(uint8_t *plane, int width, int height, int colorDepth) {
+    (void)colorDepth;
+    int size = TEST_CLAHE_TILE;
+    int tilesX = (width + size - 1) / size, tilesY = (height + size - 1) / size;
+    uint8_t (*maps)[256] = malloc((size_t)tilesX * tilesY * sizeof(*maps));
+    if (!maps) return IMGFUN_ERROR_MEMORY;
+
+    for (int ty = 0; ty < tilesY; ty++) {
+        for (int tx = 0; tx < tilesX; tx++) {
+            unsigned int hist[256] = {0}, total = 0;
+            for (int y = ty * size; y < (ty + 1) * size && y < height; y++) {
+                for (int x = tx * size; x < (tx + 1) * size && x < width; x++, total++) {
+                    hist[plane[(size_t)y * width + x]]++;
+                }
+            }
+            float clip = TEST_CLAHE_CLIP * total / 256.0f;
+            unsigned int limit = clip < 1.0f ? 1 : (unsigned int)clip, excess = 0;
+            for (int v = 0; v < 256; v++) {
+                if (hist[v] > limit) {
+                    excess += hist[v] - limit;
+                    hist[v] = limit;
+                }
+            }
+            for (int v = 0; v < 256; v++) hist[v] += excess / 256;
+            unsigned int rest = excess % 256, step = rest > 0 ? 256 / rest : 1;
+            for (int v = 0; rest > 0 && v < 256; v += step, rest--) hist[v]++;
+            test_originalEqualizationLUT(hist, total, maps[ty * tilesX + tx]);
+        }
+    }
+
+    uint8_t *out = malloc((size_t)width * height);
+    for (int y = 0; out && y < height; y++) {
+        double fy = (y + 0.5) / size - 0.5;
+        int ty = fy < 0 ? 0 : fy >= tilesY - 1 ? tilesY - 1 : (int)fy;
+        double wy = fy < 0 || fy >= tilesY - 1 ? 0 : fy - ty;
+        for (int x = 0; x < width; x++) {
+            double fx = (x + 0.5) / size - 0.5;
+            int tx = fx < 0 ? 0 : fx >= tilesX - 1 ? tilesX - 1 : (int)fx;
+            double wx = fx < 0 || fx >= tilesX - 1 ? 0 : fx - tx;
+            int v = plane[(size_t)y * width + x];
+            int right = tx + 1 < tilesX ? tx + 1 : tx, below = ty + 1 < tilesY ? ty + 1 : ty;
+            double upper = maps[ty * tilesX + tx][v] * (1 - wx) + maps[ty * tilesX + right][v] * wx;
+            double lower = maps[below * tilesX + tx][v] * (1 - wx) + maps[below * tilesX + right][v] * wx;
+            out[(size_t)y * width + x] = (uint8_t)floor(upper * (1 - wy) + lower * wy + 0.5);
+        }
+    }
+    if (out) memcpy(plane, out, (size_t)width * height);
+    free(out);
+    free(maps);
+    return out ? 0 : IMGFUN_ERROR_MEMORY;
+}
+
+// Remap the luma of an image as bmp24_equalize first did: the 24-bit image through float
+// YUV planes, the luma rounded for the remap and the chroma kept
+static int test_originalRemap(t_bmp *img, int (*remap)(uint8_t *plane, int width, int height,
+                                                       int colorDepth)) {
+    int width, height;
+    test_size(img, &width, &height);
+    size_t size = (size_t)width * height;
+    if (img->colorDepth == 8) {
+        uint8_t *plane = test_pack(img);
+        if (!plane) return IMGFUN_ERROR_MEMORY;
+        int status = remap(plane, width, height, 8);
+        if (status == 0) test_unpack(img, plane);
+        free(plane);
+        return status;
+    }
+
+    float *yuv = malloc(size * 3 * sizeof(float));
+    uint8_t *plane = malloc(size + 1);
+    if (!yuv || !plane) {
+        free(yuv);
+        free(plane);
+        return IMGFUN_ERROR_MEMORY;
+    }
+    for (int y = 0; y < height; y++) {
+        const t_pixel *row = bmp24_row(img->img24, y);
+        for (int x = 0; x < width; x++) {
+            float r = row[x].red, g = row[x].green, b = row[x].blue;
+            float *p = yuv + 3 * ((size_t)y * width + x);
+            p[0] = 0.299f * r + 0.587f * g + 0.114f * b;
+            p[1] = -0.14713f * r - 0.28886f * g + 0.436f * b;
+            p[2] = 0.615f * r - 0.51499f * g - 0.10001f * b;
+            plane[(size_t)y * width + x] = (uint8_t)fminf(fmaxf(roundf(p[0]), 0), 255);
+        }
+    }
+    int status = remap(plane, width, height, 24);
+    for (int y = 0; status == 0 && y < height; y++) {
+        t_pixel *row = bmp24_row(img->img24, y);
+        for (int x = 0; x < width; x++) {
+            const float *p = yuv + 3 * ((size_t)y * width + x);
+            float luma = plane[(size_t)y * width + x];
+            row[x].red = (uint8_t)fminf(fmaxf(luma + 1.13983f * p[2], 0), 255);
+            row[x].green = (uint8_t)fminf(fmaxf(luma - 0.39465f * p[1] - 0.58060f * p[2], 0), 255);
+            row[x].blue = (uint8_t)fminf(fmaxf(luma + 2.03211f * p[1], 0), 255);
+        }
+    }
+    free(yuv);
+    free(plane);
+    return status;
+}
+
+static int test_originalEqualize(t_bmp *img) {
+    return test_originalRemap(img, test_equalizePlane);
+}
+
+static int test_referenceClahe(t_bmp *img) {
+    return test_originalRemap(img, test_clahePlane);
+}
+
+static const t_testOp test_operations[] = {
+    { "negative", 0, 0, test_negative, test_originalNegative, STREAM_LUT, lut_negative, NULL, 0 },
+    { "brightness", 0, 0, test_brightness, test_originalBrighten, STREAM_LUT, test_lutBrightness, NULL,
+      0 },
+    { "darken", 0, 0, test_darken, test_originalDarken, STREAM_LUT, test_lutDarken, NULL, 0 },
+    { "threshold", 8, 0, test_threshold, test_originalThreshold, STREAM_LUT, test_lutThreshold, NULL,
+      0 },
+    { "grayscale", 24, 0, test_grayscale, test_originalGrayscale, STREAM_GRAYSCALE, NULL, NULL, 0 },
+    // Now computed exactly in integers: the original float sums of 1/9 can be one level
+    // off where the exact mean is a whole number
+    { "box-blur", 0, 1, test_boxBlur, test_originalBoxBlur, STREAM_KERNEL, NULL,
+      conv_stockKernels[CONV_STOCK_BOX], CONV_STOCK_SIZE },
+    { "gaussian", 0, 0, test_gaussian, test_originalGaussian, STREAM_KERNEL, NULL,
+      conv_stockKernels[CONV_STOCK_GAUSSIAN], CONV_STOCK_SIZE },
+    { "outline", 0, 0, test_outline, test_originalOutline, STREAM_KERNEL, NULL,
+      conv_stockKernels[CONV_STOCK_OUTLINE], CONV_STOCK_SIZE },
+    { "emboss", 0, 0, test_emboss, test_originalEmboss, STREAM_KERNEL, NULL,
+      conv_stockKernels[CONV_STOCK_EMBOSS], CONV_STOCK_SIZE },
+    { "sharpen", 0, 0, test_sharpen, test_originalSharpen, STREAM_KERNEL, NULL,
+      conv_stockKernels[CONV_STOCK_SHARPEN], CONV_STOCK_SIZE },
+    { "kernel-5x5", 0, 0, test_kernel5x5, test_originalKernel5x5, STREAM_KERNEL, NULL, test_kernel5, 5 },
+    // The exact integer mean
+    { "box-blur-15", 0, 0, test_boxBlur15, test_referenceBoxBlur15, -1, NULL, NULL, 0 },
+    // conv_gaussianBlur: within 1 level of the exact Gaussian below sigma 3, within 8
+    // above, where it stacks box blurs
+    { "gaussian-2.5", 0, 1, test_gaussianSigma, test_referenceGaussian25, -1, NULL, NULL, 0 },
+    { "gaussian-8", 0, 8, test_gaussianSigma8, test_referenceGaussian8, -1, NULL, NULL, 0 },
+    // The binomial weights are exact in float, so are its sums
+    { "separable-7", 0, 0, test_separable7, test_referenceSeparable7, -1, NULL, NULL, 0 },
+    // The integer rewrite promised to stay within 1 level of the original
+    { "equalize", 0, 1, test_equalize, test_originalEqualize, STREAM_EQUALIZE, NULL, NULL, 0 },
+    { "clahe", 0, 1, test_clahe, test_referenceClahe, -1, NULL, NULL, 0 },
+};
+
+// Next value of a xorshift generator
+static unsigned int test_random(unsigned int *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Write an image of random samples, or of level everywhere when it is 0 to 255. One
+// random row in eight is all 0 or all 255, so the filters also meet flat areas and
+// both ends of the range.
+static int test_writeImage(const char *filename, int width, int height, int colorDepth,
+                           int level, unsigned int seed) {
+    t_bmp img = { colorDepth, NULL, NULL };
+    if (colorDepth == 8) img.img8 = bmp8_allocate(width, height);
+    else img.img24 = bmp24_allocate(width, height, colorDepth);
+    if (!img.img8 && !img.img24) return IMGFUN_ERROR_MEMORY;
+
+    int channels = colorDepth / 8;
+    unsigned int state = seed ? seed : 1;
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = (uint8_t *)test_row(&img, y);
+        int flat = level >= 0 || test_random(&state) % 8 == 0;
+        unsigned char value = level >= 0 ? (unsigned char)level : test_random(&state) & 1 ? 255 : 0;
+        for (int x = 0; x < width * channels; x++) {
+            row[x] = flat ? value : (unsigned char)test_random(&state);
+        }
+    }
+
+    int status = colorDepth == 8 ? bmp8_saveImage(filename, img.img8)
+                                 : bmp24_saveImage(img.img24, filename);
+    bmp_free(&img);
+    return status;
+}
+
+// Largest difference between the samples of two images, and the first pixel where it
+// occurs. 256 when their sizes or depths differ.
+static int test_difference(const t_bmp *a, const t_bmp *b, int *atX, int *atY) {
+    int width, height, otherWidth, otherHeight;
+    test_size(a, &width, &height);
+    test_size(b, &otherWidth, &otherHeight);
+    *atX = *atY = 0;
+    if (a->colorDepth != b->colorDepth || width != otherWidth || height != otherHeight) return 256;
+
+    int channels = a->colorDepth / 8;
+    int largest = 0;
+    for (int y = 0; y < height; y++) {
+        const uint8_t *p = test_row(a, y), *q = test_row(b, y);
+        for (int i = 0; i < width * channels; i++) {
+            int d = abs(p[i] - q[i]);
+            if (d > largest) {
+                largest = d;
+                *atX = i / channels;
+                *atY = y;
+            }
+        }
+    }
+    return largest;
+}
+
+// Use the instruction set and thread count of a variant. Returns 0 when the CPU
+// doesn't support its instruction set.
+static int test_configure(int level, int threads) {
+    t_cpuLevel best = cpu_detect();
+    if (level > (int)best) return 0;
+    cpu_setLevel(level == TEST_BEST ? best : (t_cpuLevel)level);
+    pool_setThreadCount(threads);
+    return 1;
+}
+
+// Compute an operation the way a variant does into result. Returns 0, an IMGFUN_ERROR_
+// code, or 1 when the variant doesn't apply.
+static int test_variant(const t_testVariant *variant, const t_testOp *op, const t_testImage *image,
+                        int depth, t_bmp *result) {
+    if (variant->mode == TEST_STREAM && op->stream < 0) return 1;
+    if (variant->palette && (depth != 8 || op->stream != STREAM_LUT)) return 1;
+    if (!test_configure(variant->level, variant->threads)) return 1;
+
+    if (variant->mode == TEST_STREAM) {
+        t_streamOp streamOp = { .kind = (t_streamKind)op->stream, .kernel = op->kernel,
+                                .kernelSize = op->kernelSize };
+        lut_identity(&streamOp.lut);
+        if (op->lut) op->lut(&streamOp.lut);
+        int status = stream_process(image->input, image->output, &streamOp, 1);
+        return status != 0 ? status : bmp_load(image->output, result);
+    }
+
+    int status = bmp_load(image->input, result);
+    if (status != 0) return status;
+    if (depth == 8) {
+        bmp8_setInPlace(result->img8, variant->inPlace);
+        bmp8_setPaletteMode(result->img8, variant->palette);
+    } else {
+        bmp24_setInPlace(result->img24, variant->inPlace);
+    }
+    status = op->run(result);
+    if (depth == 8) bmp8_bakePalette(result->img8);
+    return status;
+}
+
+// Append a line or a word to the details printed after the result of an operation
+static void test_detail(char *details, size_t *used, size_t size, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(details + *used, size - *used, format, args);
+    va_end(args);
+    if (written > 0) *used += written;
+    if (*used >= size) *used = size - 1;
+}
+
+// Check one operation on one image: every variant against the reference, within the
+// tolerance, and against the first variant, exactly
+static void test_operation(const t_testOp *op, const t_testImage *image,
+                           const t_testSettings *settings, t_testCounts *counts) {
+    t_bmp reference = {0};
+    int status = bmp_load(image->input, &reference);
+    if (status == 0) status = op->reference(&reference);
+    if (status != 0) {
+        printf("  %-13s FAILED: the reference couldn't be computed (%s)\n", op->name,
+               imgfun_errorString(status));
+        if (reference.colorDepth) bmp_free(&reference);
+        counts->compared++;
+        counts->failed++;
+        return;
+    }
+
+    t_bmp first = {0};
+    int largest = 0, failed = 0;
+    char details[2048] = "";
+    size_t used = 0;
+    int variants = sizeof(test_variants) / sizeof(test_variants[0]);
+    for (int v = 0; v < variants; v++) {
+        const t_testVariant *variant = &test_variants[v];
+        t_bmp result = {0};
+        status = test_variant(variant, op, image, reference.colorDepth, &result);
+        if (status == 1) continue;
+        counts->compared++;
+        if (status != 0) {
+            test_detail(details, &used, sizeof(details), "\n    %s: %s", variant->name,
+                        imgfun_errorString(status));
+            if (result.colorDepth) bmp_free(&result);
+            failed++;
+            continue;
+        }
+
+        int x, y, sx = 0, sy = 0;
+        int difference = test_difference(&reference, &result, &x, &y);
+        int mismatch = first.colorDepth ? test_difference(&first, &result, &sx, &sy) : 0;
+        if (difference > largest) largest = difference;
+        if (difference > op->tolerance) {
+            test_detail(details, &used, sizeof(details), "\n    %s: difference %d at (%d, %d)",
+                        variant->name, difference, x, y);
+        }
+        if (mismatch > 0) {
+            test_detail(details, &used, sizeof(details), "\n    %s: differs from %s by %d at (%d, %d)",
+                        variant->name, test_variants[0].name, mismatch, sx, sy);
+        }
+        if (settings->verbose && difference <= op->tolerance && mismatch == 0) {
+            test_detail(details, &used, sizeof(details), " %s=%d", variant->name, difference);
+        }
+        if (difference > op->tolerance || mismatch > 0) failed++;
+
+        if (v == 0) first = result;
+        else bmp_free(&result);
+    }
+    if (first.colorDepth) bmp_free(&first);
+    bmp_free(&reference);
+    remove(image->output);
+
+    counts->failed += failed;
+    printf("  %-13s max diff %3d  tolerance %d%s%s\n", op->name, largest, op->tolerance,
+           failed ? "  FAILED" : "", details);
+}
+
+// Check the counts of every channel and of the luma against a count pixel by pixel,
+// with each instruction set and on several threads
+static void test_histogram(const t_bmp *img, t_testCounts *counts) {
+    int width, height;
+    test_size(img, &width, &height);
+    int channels = img->colorDepth / 8;
+    t_histogram expected;
+    memset(&expected, 0, sizeof(expected));
+    for (int y = 0; y < height; y++) {
+        const uint8_t *p = test_row(img, y);
+        for (int x = 0; x < width; x++, p += channels) {
+            for (int c = 0; c < channels; c++) expected.channel[c][p[c]]++;
+            expected.luma[channels == 1 ? p[0] : hist_luma(p[0], p[1], p[2])]++;
+        }
+    }
+
+    t_raster raster = { (uint8_t *)test_row(img, 0), width, height, channels,
+                        height > 1 ? (size_t)(test_row(img, 1) - test_row(img, 0)) : 0 };
+    unsigned int largest = 0;
+    int failed = 0;
+    for (int level = CPU_SCALAR; level <= CPU_AVX512; level++) {
+        for (int threads = 1; threads <= TEST_THREADS; threads += TEST_THREADS - 1) {
+            if (!test_configure(level, threads)) continue;
+            t_histogram hist;
+            counts->compared++;
+            if (hist_compute(&raster, &hist) != 0) {
+                failed++;
+                continue;
+            }
+            unsigned int difference = 0;
+            for (int v = 0; v < 256; v++) {
+                for (int c = 0; c < channels; c++) {
+                    unsigned int d = hist.channel[c][v] > expected.channel[c][v]
+                                     ? hist.channel[c][v] - expected.channel[c][v]
+                                     : expected.channel[c][v] - hist.channel[c][v];
+                    if (d > difference) difference = d;
+                }
+                unsigned int d = hist.luma[v] > expected.luma[v] ? hist.luma[v] - expected.luma[v]
+                                                                 : expected.luma[v] - hist.luma[v];
+                if (d > difference) difference = d;
+            }
+            if (difference > largest) largest = difference;
+            if (difference > 0) failed++;
+        }
+    }
+    counts->failed += failed;
+    printf("  %-13s max diff %3u  tolerance 0%s\n", "histogram", largest, failed ? "  FAILED" : "");
+}
+
+// Check every operation of the image's color depth on one file
+static void test_file(const t_testImage *image, const t_testSettings *settings,
+                      t_testCounts *counts) {
+    t_bmp img;
+    int status = bmp_load(image->input, &img);
+    if (status != 0) {
+        printf("%s: FAILED to load (%s)\n", image->name, imgfun_errorString(status));
+        counts->compared++;
+        counts->failed++;
+        return;
+    }
+    int width, height;
+    test_size(&img, &width, &height);
+    printf("%s: %dx%d, %d-bit\n", image->name, width, height, img.colorDepth);
+
+    if (!settings->only || strstr("histogram", settings->only)) test_histogram(&img, counts);
+    int depth = img.colorDepth;
+    bmp_free(&img);
+
+    int count = sizeof(test_operations) / sizeof(test_operations[0]);
+    for (int i = 0; i < count; i++) {
+        const t_testOp *op = &test_operations[i];
+        if (op->depths != 0 && op->depths != depth) continue;
+        if (settings->only && !strstr(op->name, settings->only)) continue;
+        test_operation(op, image, settings, counts);
+        fflush(stdout);
+    }
+}
+
+static void test_printUsage(FILE *out) {
+    fprintf(out,
+            "Usage: imgfun_test [OPTIONS]\n"
+            "Runs every operation on the bundled images and on random images of odd sizes\n"
+            "with each instruction set, on several threads, in place, in palette mode and\n"
+            "streamed, and fails when a result differs from the original implementation of\n"
+            "the operation by more than it allows, or at all from the scalar kernels.\n"
+            "Options:\n"
+            "  --seed=N          seed of the random images (default 1)\n"
+            "  --only=TEXT       only the operations whose name contains TEXT\n"
+            "  --verbose         print the difference of every variant\n"
+            "  --images=DIR      directory of the bundled images\n");
+}
+
+int main(int argc, char **argv) {
+    t_testSettings settings = { IMGFUN_TEST_IMAGES, NULL, 1, 0 };
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = strchr(arg, '=');
+        value = value ? value + 1 : "";
+        int ok = 1;
+        if (!strncmp(arg, "--seed=", 7)) settings.seed = (unsigned int)strtoul(value, NULL, 10);
+        else if (!strncmp(arg, "--only=", 7)) settings.only = value;
+        else if (!strcmp(arg, "--verbose")) settings.verbose = 1;
+        else if (!strncmp(arg, "--images=", 9)) settings.images = value;
+        else if (!strcmp(arg, "--help")) {
+            test_printUsage(stdout);
+            return 0;
+        } else ok = 0;
+        if (!ok) {
+            test_printUsage(stderr);
+            return 2;
+        }
+    }
+
+    const char *tmp = getenv("TMPDIR");
+    if (!tmp || !*tmp) tmp = "/tmp";
+    char input[TEST_MAX_PATH], output[TEST_MAX_PATH], path[TEST_MAX_PATH];
+    snprintf(input, sizeof(input), "%s/imgfun_test_%d_in.bmp", tmp, (int)getpid());
+    snprintf(output, sizeof(output), "%s/imgfun_test_%d_out.bmp", tmp, (int)getpid());
+
+    printf("imgfun_test: instruction sets up to %s, seed %u\n", cpu_levelName(cpu_detect()),
+           settings.seed);
+    t_testCounts counts = {0};
+
+    int bundled = sizeof(test_bundled) / sizeof(test_bundled[0]);
+    for (int i = 0; i < bundled; i++) {
+        snprintf(path, sizeof(path), "%s/%s", settings.images, test_bundled[i]);
+        t_testImage image = { test_bundled[i], path, output };
+        test_file(&image, &settings, &counts);
+    }
+
+    int levels = sizeof(test_flatLevels) / sizeof(test_flatLevels[0]);
+    int sizes = sizeof(test_sizes) / sizeof(test_sizes[0]);
+    for (int i = 0; i < levels + sizes; i++) {
+        for (int depth = 8; depth <= 24; depth += 16) {
+            const int *size = i < levels ? test_flatSize : test_sizes[i - levels];
+            int level = i < levels ? test_flatLevels[i] : -1;
+            char name[64];
+            if (level >= 0) snprintf(name, sizeof(name), "flat-%d-%dx%d-%d", level, size[0], size[1], depth);
+            else snprintf(name, sizeof(name), "random-%dx%d-%d", size[0], size[1], depth);
+            if (test_writeImage(input, size[0], size[1], depth, level,
+                                settings.seed * 7919u + i * 2 + depth) != 0) {
+                printf("%s: FAILED to write %s\n", name, input);
+                counts.compared++;
+                counts.failed++;
+                continue;
+            }
+            t_testImage image = { name, input, output };
+            test_file(&image, &settings, &counts);
+            remove(input);
+        }
+    }
+
+    printf("imgfun_test: %d comparisons, %d failed\n", counts.compared, counts.failed);
+    bmp_releaseScratch();
+    pool_shutdown();
+    return counts.failed ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+#include "threadpool.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Ranges handed out per thread, so faster threads can pick up more work
+#define POOL_CHUNKS_PER_THREAD 4
+
+// One parallel loop being executed by the pool
+typedef struct {
+    t_poolTask task;
+    void *context;
+    int count;             // Items in the loop
+    int chunkSize;         // Items per range
+    int chunks;            // Number of ranges
+    atomic_int next;       // Next range to hand out
+    atomic_int finished;   // Ranges done
+    int active;            // Workers currently using this job (protected by pool_lock)
+} t_poolJob;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+// Held by the thread whose loop is running: one parallel loop at a time
+static pthread_mutex_t pool_submit = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t *pool_workers = NULL;
+static int pool_workerCount = 0;
+static int pool_requested = -1;       // Requested thread count, -1 until initialized
+static int pool_stopping = 0;
+static t_poolJob *pool_job = NULL;
+static unsigned long pool_generation = 0;
+static _Thread_local int pool_isWorker = 0;
+
+// Run ranges of a job until none are left
+static void pool_runChunks(t_poolJob *job) {
+    t_traceSpan span;
+    trace_begin(&span);
+    int ran = 0;
+    for (;;) {
+        int chunk = atomic_fetch_add(&job->next, 1);
+        if (chunk >= job->chunks) break;
+        int begin = chunk * job->chunkSize;
+        int end = begin + job->chunkSize < job->count ? begin + job->chunkSize : job->count;
+        job->task(job->context, begin, end);
+        atomic_fetch_add(&job->finished, 1);
+        ran = 1;
+    }
+    // The busy time of this thread in the loop
+    if (ran) trace_end(&span, TRACE_POOL_TASK, 0);
+}
+
+// Worker thread: wait for a new job, help with it, repeat
+static void *pool_worker(void *arg) {
+    (void)arg;
+    pool_isWorker = 1;
+    trace_nameThread("pool worker");
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    seen = pool_generation;
+    for (;;) {
+        while (!pool_stopping && (pool_job == NULL || pool_generation == seen)) {
+            pthread_cond_wait(&pool_wake, &pool_lock);
+        }
+        if (pool_stopping) break;
+
+        seen = pool_generation;
+        t_poolJob *job = pool_job;
+        job->active++;
+        pthread_mutex_unlock(&pool_lock);
+
+        pool_runChunks(job);
+
+        pthread_mutex_lock(&pool_lock);
+        job->active--;
+        if (job->active == 0) pthread_cond_broadcast(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+// Thread count to use when none was requested: IMGFUN_THREADS, else one per CPU
+static int pool_defaultCount(void) {
+    const char *env = getenv("IMGFUN_THREADS");
+    if (env && atoi(env) > 0) return atoi(env);
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Start the workers if needed. Called with pool_submit held.
+static void pool_start(void) {
+    pthread_mutex_lock(&pool_lock);
+    if (pool_requested < 0) pool_requested = 0;
+    int wanted = (pool_requested > 0 ? pool_requested : pool_defaultCount()) - 1;
+    if (pool_workers == NULL && wanted > 0) {
+        pool_workers = malloc(wanted * sizeof(pthread_t));
+        pool_workerCount = 0;
+        pool_stopping = 0;
+        for (int i = 0; pool_workers && i < wanted; i++) {
+            if (pthread_create(&pool_workers[i], NULL, pool_worker, NULL) != 0) break;
+            pool_workerCount++;
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Stop and join the worker threads (they restart on next use)
+void pool_shutdown(void) {
+    pthread_mutex_lock(&pool_submit);
+    pthread_mutex_lock(&pool_lock);
+    pool_stopping = 1;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < pool_workerCount; i++) pthread_join(pool_workers[i], NULL);
+    free(pool_workers);
+    pool_workers = NULL;
+    pool_workerCount = 0;
+    pool_stopping = 0;
+    pthread_mutex_unlock(&pool_submit);
+}
+
+// Set how many threads run image kernels
+void pool_setThreadCount(int count) {
+    pool_shutdown();
+    pthread_mutex_lock(&pool_lock);
+    pool_requested = count > 0 ? count : 0;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Get how many threads run image kernels
+int pool_threadCount(void) {
+    pthread_mutex_lock(&pool_lock);
+    int requested = pool_requested;
+    pthread_mutex_unlock(&pool_lock);
+    return requested > 0 ? requested : pool_defaultCount();
+}
+
+// Run task over [0, count) on the worker threads and the calling thread
+void pool_parallelFor(int count, int grain, t_poolTask task, void *context) {
+    if (count <= 0) return;
+    if (grain < 1) grain = 1;
+
+    int threads = pool_threadCount();
+    if (threads <= 1 || count < 2 * grain || pool_isWorker
+        || pthread_mutex_trylock(&pool_submit) != 0) {
+        task(context, 0, count);
+        return;
+    }
+    pool_start();
+    if (pool_workerCount == 0) {
+        pthread_mutex_unlock(&pool_submit);
+        task(context, 0, count);
+        return;
+    }
+
+    t_poolJob job;
+    job.task = task;
+    job.context = context;
+    job.count = count;
+    job.chunks = threads * POOL_CHUNKS_PER_THREAD;
+    if (job.chunks > count / grain) job.chunks = count / grain;
+    job.chunkSize = (count + job.chunks - 1) / job.chunks;
+    job.chunks = (count + job.chunkSize - 1) / job.chunkSize;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.finished, 0);
+    job.active = 0;
+
+    pthread_mutex_lock(&pool_lock);
+    pool_job = &job;
+    pool_generation++;
+    pthread_cond_broadcast(&pool_wake);
+    pthread_mutex_unlock(&pool_lock);
+
+    pool_runChunks(&job);
+
+    // Wait for the last ranges and for every worker to let go of the job
+    pthread_mutex_lock(&pool_lock);
+    while (atomic_load(&job.finished) < job.chunks || job.active > 0) {
+        pthread_cond_wait(&pool_done, &pool_lock);
+    }
+    pool_job = NULL;
+    pthread_mutex_unlock(&pool_lock);
+    pthread_mutex_unlock(&pool_submit);
+}
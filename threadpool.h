@@ -0,0 +1,23 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+// Task run by the pool on the range [begin, end) of a parallel loop
+typedef void (*t_poolTask)(void *context, int begin, int end);
+
+// Function to set how many threads run image kernels (0 = one per CPU, 1 = serial).
+// The IMGFUN_THREADS environment variable sets the initial value.
+// Must not be called while a parallel loop is running.
+void pool_setThreadCount(int count);
+
+// Function to get how many threads run image kernels
+int pool_threadCount(void);
+
+// Function to run task over [0, count) split into contiguous ranges of at least
+// grain items, on the persistent worker threads and the calling thread.
+// Returns once every range is done. Nested or concurrent calls run serially.
+void pool_parallelFor(int count, int grain, t_poolTask task, void *context);
+
+// Function to stop and join the worker threads (they restart on next use)
+void pool_shutdown(void);
+
+#endif // THREADPOOL_H
@@ -0,0 +1,201 @@
+#include "trace.h"
+#include "imgfun.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Events kept at most; later ones are counted as dropped
+#define TRACE_MAX_EVENTS (1 << 20)
+
+// One finished operation
+typedef struct {
+    const char *name;
+    int thread;
+    double start;     // Microseconds since tracing started
+    double duration;  // Microseconds
+    unsigned long long counters[TRACE_COUNTERS];
+} t_traceEvent;
+
+// Thread that recorded events
+typedef struct {
+    const char *name;  // NULL until trace_nameThread
+} t_traceThread;
+
+// Names of the counters in the events' arguments
+static const char *trace_counterNames[TRACE_COUNTERS] = {
+    "bytes_read", "bytes_written", "pixels", "allocations"
+};
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static int trace_on = 0;
+static char *trace_path = NULL;
+static double trace_origin = 0;
+
+// Everything below is protected by trace_lock
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static t_traceEvent *trace_events = NULL;
+static int trace_eventCount = 0;
+static int trace_eventCapacity = 0;
+static long trace_dropped = 0;
+static t_traceThread *trace_threads = NULL;
+static int trace_threadCount = 0;
+
+// Counters and trace id (1-based, 0 until its first event) of each thread
+static _Thread_local unsigned long long trace_counters[TRACE_COUNTERS];
+static _Thread_local int trace_thread = 0;
+
+// Current monotonic time in microseconds
+static double trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec * 1e-3;
+}
+
+// Trace id of the calling thread, registering it on first use. Called with trace_lock held.
+static int trace_threadId(void) {
+    if (trace_thread == 0) {
+        t_traceThread *threads = realloc(trace_threads, (trace_threadCount + 1) * sizeof(t_traceThread));
+        if (!threads) return 0;
+        trace_threads = threads;
+        trace_threads[trace_threadCount].name = NULL;
+        trace_thread = ++trace_threadCount;
+    }
+    return trace_thread;
+}
+
+// Write a string as a JSON string
+static void trace_writeString(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char)*s >= 0x20) fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// Write every event to the trace file (at exit)
+static void trace_write(void) {
+    pthread_mutex_lock(&trace_lock);
+    FILE *f = fopen(trace_path, "w");
+    if (!f) {
+        pthread_mutex_unlock(&trace_lock);
+        imgfun_fail(IMGFUN_ERROR_WRITE, "Couldn't write the trace to %s", trace_path);
+        return;
+    }
+
+    int pid = (int)getpid();
+    fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for (int t = 0; t < trace_threadCount; t++) {
+        fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                   "\"args\": {\"name\": ", t ? "," : "", pid, t + 1);
+        if (trace_threads[t].name) {
+            trace_writeString(f, trace_threads[t].name);
+        } else {
+            fprintf(f, "\"thread %d\"", t + 1);
+        }
+        fprintf(f, "}}");
+    }
+    for (int i = 0; i < trace_eventCount; i++) {
+        const t_traceEvent *e = &trace_events[i];
+        fprintf(f, "%s\n{\"name\": ", i || trace_threadCount ? "," : "");
+        trace_writeString(f, e->name);
+        fprintf(f, ", \"cat\": \"imgfun\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, "
+                   "\"dur\": %.3f, \"args\": {", pid, e->thread, e->start, e->duration);
+        int first = 1;
+        for (int c = 0; c < TRACE_COUNTERS; c++) {
+            if (e->counters[c] == 0) continue;
+            fprintf(f, "%s\"%s\": %llu", first ? "" : ", ", trace_counterNames[c], e->counters[c]);
+            first = 0;
+        }
+        fprintf(f, "}}");
+    }
+
+    // Time each thread spent running ranges of parallel loops
+    fprintf(f, "\n], \"otherData\": {\"dropped_events\": %ld, \"pool_busy_ms\": {", trace_dropped);
+    for (int t = 0; t < trace_threadCount; t++) {
+        double busy = 0;
+        for (int i = 0; i < trace_eventCount; i++) {
+            if (trace_events[i].thread == t + 1 && strcmp(trace_events[i].name, TRACE_POOL_TASK) == 0) {
+                busy += trace_events[i].duration;
+            }
+        }
+        fprintf(f, "%s\"%d\": %.3f", t ? ", " : "", t + 1, busy / 1e3);
+    }
+    fprintf(f, "}}}\n");
+    int failed = fclose(f) != 0;
+    pthread_mutex_unlock(&trace_lock);
+    if (failed) imgfun_fail(IMGFUN_ERROR_WRITE, "Couldn't write the trace to %s", trace_path);
+}
+
+// Read IMGFUN_TRACE once
+static void trace_init(void) {
+    const char *path = getenv("IMGFUN_TRACE");
+    if (!path || !*path) return;
+    trace_path = malloc(strlen(path) + 1);
+    if (!trace_path || atexit(trace_write) != 0) return;
+    strcpy(trace_path, path);
+    trace_origin = trace_now();
+    trace_on = 1;
+}
+
+// Tell whether tracing is on
+int trace_enabled(void) {
+    pthread_once(&trace_once, trace_init);
+    return trace_on;
+}
+
+// Start timing an operation
+void trace_begin(t_traceSpan *span) {
+    if (!trace_enabled()) {
+        span->start = -1;
+        return;
+    }
+    memcpy(span->counters, trace_counters, sizeof(trace_counters));
+    span->start = trace_now() - trace_origin;
+}
+
+// Record the operation started with trace_begin
+void trace_end(const t_traceSpan *span, const char *name, unsigned long long pixels) {
+    if (span->start < 0) return;
+    trace_counters[TRACE_PIXELS] += pixels;
+
+    t_traceEvent event;
+    event.name = name;
+    event.start = span->start;
+    event.duration = trace_now() - trace_origin - span->start;
+    for (int c = 0; c < TRACE_COUNTERS; c++) event.counters[c] = trace_counters[c] - span->counters[c];
+
+    pthread_mutex_lock(&trace_lock);
+    event.thread = trace_threadId();
+    if (trace_eventCount == trace_eventCapacity && trace_eventCapacity < TRACE_MAX_EVENTS) {
+        int capacity = trace_eventCapacity ? 2 * trace_eventCapacity : 1024;
+        t_traceEvent *events = realloc(trace_events, capacity * sizeof(t_traceEvent));
+        if (events) {
+            trace_events = events;
+            trace_eventCapacity = capacity;
+        }
+    }
+    if (event.thread && trace_eventCount < trace_eventCapacity) {
+        trace_events[trace_eventCount++] = event;
+    } else {
+        trace_dropped++;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+// Add to a counter of the calling thread (kept even when not tracing: it's one addition)
+void trace_count(t_traceCounter counter, unsigned long long amount) {
+    trace_counters[counter] += amount;
+}
+
+// Name the calling thread in the trace
+void trace_nameThread(const char *name) {
+    if (!trace_enabled()) return;
+    pthread_mutex_lock(&trace_lock);
+    int thread = trace_threadId();
+    if (thread) trace_threads[thread - 1].name = name;
+    pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Tracing of the library's operations. When the IMGFUN_TRACE environment variable names a
+// file, every instrumented call becomes an event with its wall time and counters, and the
+// events are written there as Chrome trace JSON (chrome://tracing, Perfetto) when the
+// process exits. Otherwise each call below costs one test of a flag.
+
+// Counters kept per thread; an event records how much each grew while it ran
+typedef enum {
+    TRACE_BYTES_READ,     // Bytes of image files read or mapped
+    TRACE_BYTES_WRITTEN,  // Bytes of image files written
+    TRACE_PIXELS,         // Pixels processed
+    TRACE_ALLOCATIONS,    // Image-sized buffers allocated (not reused)
+    TRACE_COUNTERS
+} t_traceCounter;
+
+// Name of the events the thread pool records for the ranges each thread runs
+#define TRACE_POOL_TASK "pool_task"
+
+// Start of an operation, filled by trace_begin
+typedef struct {
+    double start;  // Microseconds since tracing started, negative when not tracing
+    unsigned long long counters[TRACE_COUNTERS];
+} t_traceSpan;
+
+// Function to tell whether tracing is on (reads IMGFUN_TRACE on first use)
+int trace_enabled(void);
+
+// Function to start timing an operation on the calling thread
+void trace_begin(t_traceSpan *span);
+
+// Function to record the operation started with trace_begin as an event called name
+// (a string that outlives the process, e.g. __func__), adding pixels to TRACE_PIXELS first
+void trace_end(const t_traceSpan *span, const char *name, unsigned long long pixels);
+
+// Function to add to a counter of the calling thread
+void trace_count(t_traceCounter counter, unsigned long long amount);
+
+// Function to name the calling thread in the trace
+void trace_nameThread(const char *name);
+
+#endif // TRACE_H